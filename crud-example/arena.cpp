@@ -0,0 +1,80 @@
+#include "arena.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace crud_example
+{
+
+namespace
+{
+
+// Chunks above this total size are released by reset().
+const std::size_t max_retained_arena_size = 1024u * 1024u;
+
+} /* namespace anonymous */
+
+monotonic_arena_t::monotonic_arena_t(std::size_t chunk_size)
+	:	m_chunk_size{chunk_size}
+{
+}
+
+void
+monotonic_arena_t::add_chunk(std::size_t min_size)
+{
+	const auto size = std::max(m_chunk_size, min_size);
+	m_chunks.push_back(chunk_t{std::unique_ptr<char[]>{new char[size]}, size});
+}
+
+void *
+monotonic_arena_t::allocate(std::size_t size, std::size_t alignment)
+{
+	for(;;)
+	{
+		if(m_current_chunk == m_chunks.size())
+			// The space for the alignment is added too.
+			add_chunk(size + alignment);
+
+		auto & chunk = m_chunks[m_current_chunk];
+		const auto base = reinterpret_cast<std::uintptr_t>(chunk.m_memory.get());
+		const auto aligned = (base + m_used + alignment - 1u) & ~(alignment - 1u);
+		const auto offset = static_cast<std::size_t>(aligned - base);
+
+		if(offset + size <= chunk.m_size)
+		{
+			m_used = offset + size;
+			return chunk.m_memory.get() + offset;
+		}
+
+		// The rest of the current chunk is wasted.
+		++m_current_chunk;
+		m_used = 0u;
+	}
+}
+
+void
+monotonic_arena_t::reset() noexcept
+{
+	std::size_t retained = 0u;
+	auto it = m_chunks.begin();
+	for(; it != m_chunks.end(); ++it)
+	{
+		retained += it->m_size;
+		if(max_retained_arena_size < retained)
+			break;
+	}
+	m_chunks.erase(it, m_chunks.end());
+
+	m_current_chunk = 0u;
+	m_used = 0u;
+}
+
+monotonic_arena_t &
+monotonic_arena_t::for_current_thread()
+{
+	static thread_local monotonic_arena_t arena;
+	return arena;
+}
+
+} /* namespace crud_example */
+
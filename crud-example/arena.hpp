@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+
+namespace crud_example
+{
+
+// Monotonic arena for objects that live during processing of a request.
+//
+// Memory is taken from big chunks and is never freed individually.
+// All memory is released at once by reset(), but chunks are kept
+// for the next request (if they aren't too big).
+//
+// The arena isn't thread-safe. Every worker thread has its own arena.
+class monotonic_arena_t
+{
+	struct chunk_t
+	{
+		std::unique_ptr<char[]> m_memory;
+		std::size_t m_size;
+	};
+
+	const std::size_t m_chunk_size;
+
+	std::vector<chunk_t> m_chunks;
+
+	// The chunk for the next allocation and the used part of it.
+	std::size_t m_current_chunk{0u};
+	std::size_t m_used{0u};
+
+	void
+	add_chunk(std::size_t min_size);
+
+public:
+	static constexpr std::size_t default_chunk_size = 64u * 1024u;
+
+	explicit monotonic_arena_t(std::size_t chunk_size = default_chunk_size);
+
+	monotonic_arena_t(const monotonic_arena_t &) = delete;
+	monotonic_arena_t(monotonic_arena_t &&) = delete;
+
+	void *
+	allocate(std::size_t size, std::size_t alignment);
+
+	// Makes all memory of the arena available again.
+	//
+	// NOTE: all objects allocated from the arena should be
+	// destroyed already.
+	void
+	reset() noexcept;
+
+	static monotonic_arena_t &
+	for_current_thread();
+};
+
+// Resets the arena at the end of the scope.
+class arena_reset_guard_t
+{
+	monotonic_arena_t & m_arena;
+
+public:
+	arena_reset_guard_t(monotonic_arena_t & arena) noexcept : m_arena{arena} {}
+	~arena_reset_guard_t() noexcept { m_arena.reset(); }
+
+	arena_reset_guard_t(const arena_reset_guard_t &) = delete;
+	arena_reset_guard_t(arena_reset_guard_t &&) = delete;
+};
+
+// Allocator for standard containers that takes memory from an arena.
+template<typename T>
+class arena_allocator_t
+{
+	template<typename U> friend class arena_allocator_t;
+
+	monotonic_arena_t * m_arena;
+
+public:
+	using value_type = T;
+
+	arena_allocator_t(monotonic_arena_t & arena) noexcept : m_arena{&arena} {}
+
+	template<typename U>
+	arena_allocator_t(const arena_allocator_t<U> & other) noexcept
+		:	m_arena{other.m_arena}
+	{}
+
+	T *
+	allocate(std::size_t n)
+	{
+		return static_cast<T *>(m_arena->allocate(n * sizeof(T), alignof(T)));
+	}
+
+	void
+	deallocate(T *, std::size_t) noexcept
+	{
+		// The memory is released by monotonic_arena_t::reset().
+	}
+
+	template<typename U>
+	bool
+	operator==(const arena_allocator_t<U> & other) const noexcept
+	{
+		return m_arena == other.m_arena;
+	}
+
+	template<typename U>
+	bool
+	operator!=(const arena_allocator_t<U> & other) const noexcept
+	{
+		return m_arena != other.m_arena;
+	}
+};
+
+} /* namespace crud_example */
+
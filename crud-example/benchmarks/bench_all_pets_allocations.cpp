@@ -0,0 +1,140 @@
+// Count of memory allocations for reading of the list of all pets.
+//
+// Allocations are counted by counting_allocations.hpp. Cases:
+// - "std::string copies": every row is copied into model::all_pets_t
+//   with std::string for every field. That's how the list was read
+//   before the arena;
+// - "arena": db_layer_t::get_all_pets(arena) as it's done in
+//   all_pets_response_mode_t::single_body;
+// - "views": db_layer_t::for_each_pet() without copying as it's
+//   done in all_pets_response_mode_t::chunked_stream.
+//
+// Strings of generated pets are longer than the small string buffer
+// of std::string, like real names and URLs of pictures.
+//
+// Usage: bench_all_pets_allocations [pets_count] [db_file]
+
+#include "bench_common.hpp"
+#include "counting_allocations.hpp"
+
+#include "../db_layer.hpp"
+#include "../arena.hpp"
+
+#include <future>
+#include <stdexcept>
+
+using namespace crud_example;
+
+namespace
+{
+
+void
+fill_db(db_layer_t & db, std::size_t pets_count)
+{
+	model::bunch_of_pets_without_id_t pets;
+	pets.m_pets.reserve(pets_count);
+	for(std::size_t i = 0u; i != pets_count; ++i)
+	{
+		const auto n = std::to_string(i);
+		model::pet_without_id_t pet;
+		pet.m_data.m_name = "Pet number " + n;
+		pet.m_data.m_type = "dog or maybe a cat";
+		pet.m_data.m_owner = "John Smith from the " + n + " street";
+		pet.m_data.m_picture = "https://example.com/pictures/" + n + ".jpg";
+		pets.m_pets.push_back(std::move(pet));
+	}
+
+	std::promise<void> completed;
+	db.async_create_bunch_of_pets(std::move(pets),
+		[&completed](write_result_t<model::bunch_of_pet_ids_t> result) {
+			try
+			{
+				result.value();
+				completed.set_value();
+			}
+			catch(...)
+			{
+				completed.set_exception(std::current_exception());
+			}
+		});
+	completed.get_future().get();
+}
+
+std::string
+to_string(const model::string_ref_t & ref)
+{
+	return std::string{ref.m_data, ref.m_size};
+}
+
+template<typename F>
+void
+run_case(const char * name, std::size_t pets_count, F && read)
+{
+	// The first run warms up the arena and statements.
+	if(pets_count != read())
+		throw std::runtime_error("unexpected count of pets");
+
+	std::size_t allocations = 0u;
+	const auto seconds = bench::measure([&] {
+			allocations = bench::count_allocations(read);
+		});
+
+	std::printf("%-20s %14zu %12.3f %10.1f\n", name, allocations,
+			static_cast<double>(allocations) / static_cast<double>(pets_count),
+			seconds * 1e3);
+}
+
+} /* namespace anonymous */
+
+int
+main(int argc, char ** argv)
+{
+	const auto pets_count = bench::size_arg(argc, argv, 1, 100000u);
+	const std::string file_name{
+			argc > 2 ? argv[2] : "bench_all_pets_allocations.db3"};
+
+	std::remove(file_name.c_str());
+
+	{
+		db_params_t params;
+		params.m_database_name = file_name;
+		params.m_journal_mode = journal_mode_t::wal;
+		db_layer_t db{params};
+
+		fill_db(db, pets_count);
+
+		std::printf("pets: %zu\n", pets_count);
+		std::printf("%-20s %14s %12s %10s\n",
+				"case", "allocations", "per pet", "ms");
+
+		run_case("std::string copies", pets_count, [&] {
+				model::all_pets_t pets;
+				db.for_each_pet([&pets](const model::pet_view_t & view) {
+						model::pet_with_id_t pet;
+						pet.m_id = view.m_id;
+						pet.m_data.m_name = to_string(view.m_name);
+						pet.m_data.m_type = to_string(view.m_type);
+						pet.m_data.m_owner = to_string(view.m_owner);
+						pet.m_data.m_picture = to_string(view.m_picture);
+						pets.m_pets.push_back(std::move(pet));
+					});
+				return pets.m_pets.size();
+			});
+
+		run_case("arena", pets_count, [&] {
+				auto & arena = monotonic_arena_t::for_current_thread();
+				arena_reset_guard_t arena_reset{arena};
+				return db.get_all_pets(arena).size();
+			});
+
+		run_case("views", pets_count, [&] {
+				std::size_t count = 0u;
+				db.for_each_pet([&count](const model::pet_view_t &) { ++count; });
+				return count;
+			});
+	}
+
+	std::remove(file_name.c_str());
+
+	return 0;
+}
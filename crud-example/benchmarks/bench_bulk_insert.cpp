@@ -0,0 +1,294 @@
+// Bulk insert of pets into SQLite by different ways of getting IDs
+// of new rows.
+//
+// The benchmark uses the sqlite3 C API with the same SQL statements
+// as db_layer_t:
+// - "select last_insert_rowid()": the previous way, the second
+//   statement for every row;
+// - "returning id": the insert statement returns the ID itself;
+// - "sqlite3_last_insert_rowid()": the fallback for SQLite before
+//   3.35.0, the ID is taken via the C handle;
+// - "multi-row inserts": rows are inserted by 256, 64 and 16 rows
+//   per statement, the remainder one by one. It's the way of
+//   db_layer_t::do_insert_pets().
+//
+// Every case inserts all pets in one transaction into a new DB in
+// WAL mode.
+//
+// Usage: bench_bulk_insert [pets_count] [db_file]
+
+#include "bench_common.hpp"
+
+#include <sqlite3.h>
+
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+
+struct pet_t
+{
+	std::string m_name;
+	std::string m_type;
+	std::string m_owner;
+	std::string m_picture;
+};
+
+using ids_t = std::vector<std::int64_t>;
+
+void
+check(sqlite3 * db, int rc)
+{
+	if(SQLITE_OK != rc && SQLITE_ROW != rc && SQLITE_DONE != rc)
+		throw std::runtime_error(sqlite3_errmsg(db));
+}
+
+class statement_t
+{
+	sqlite3 * m_db;
+	sqlite3_stmt * m_stmt{nullptr};
+
+public:
+	statement_t(sqlite3 * db, const std::string & sql)
+		:	m_db{db}
+	{
+		check(m_db, sqlite3_prepare_v2(db, sql.c_str(), -1, &m_stmt, nullptr));
+	}
+
+	statement_t(const statement_t &) = delete;
+	statement_t & operator=(const statement_t &) = delete;
+
+	~statement_t()
+	{
+		sqlite3_finalize(m_stmt);
+	}
+
+	void
+	bind(int index, const std::string & value)
+	{
+		check(m_db, sqlite3_bind_text(m_stmt, index,
+				value.data(), static_cast<int>(value.size()), SQLITE_STATIC));
+	}
+
+	// Returns true if there is a row.
+	bool
+	step()
+	{
+		const auto rc = sqlite3_step(m_stmt);
+		check(m_db, rc);
+		return SQLITE_ROW == rc;
+	}
+
+	std::int64_t
+	column_int64(int index)
+	{
+		return sqlite3_column_int64(m_stmt, index);
+	}
+
+	void
+	reset()
+	{
+		sqlite3_reset(m_stmt);
+		sqlite3_clear_bindings(m_stmt);
+	}
+};
+
+class database_t
+{
+	sqlite3 * m_db{nullptr};
+
+public:
+	explicit database_t(const std::string & file_name)
+	{
+		std::remove(file_name.c_str());
+		std::remove((file_name + "-wal").c_str());
+		std::remove((file_name + "-shm").c_str());
+
+		check(m_db, sqlite3_open(file_name.c_str(), &m_db));
+		exec("pragma journal_mode=wal;");
+		exec(R"sql(
+				create table pets(
+					id integer primary key autoincrement,
+					name text,
+					type text,
+					owner text,
+					picture text);
+			)sql");
+	}
+
+	database_t(const database_t &) = delete;
+	database_t & operator=(const database_t &) = delete;
+
+	~database_t()
+	{
+		sqlite3_close(m_db);
+	}
+
+	sqlite3 *
+	handle() const noexcept { return m_db; }
+
+	void
+	exec(const char * sql)
+	{
+		check(m_db, sqlite3_exec(m_db, sql, nullptr, nullptr, nullptr));
+	}
+};
+
+const char * const single_row_insert_sql =
+		"insert into pets(name, type, owner, picture) "
+		"values(:name, :type, :owner, :picture)";
+
+void
+bind_pet(statement_t & stmt, int first_index, const pet_t & pet)
+{
+	stmt.bind(first_index, pet.m_name);
+	stmt.bind(first_index + 1, pet.m_type);
+	stmt.bind(first_index + 2, pet.m_owner);
+	stmt.bind(first_index + 3, pet.m_picture);
+}
+
+void
+insert_with_select_rowid(
+	database_t & db, const std::vector<pet_t> & pets, ids_t & ids)
+{
+	statement_t insert{db.handle(), single_row_insert_sql};
+	statement_t last_id{db.handle(), "select last_insert_rowid()"};
+
+	for(const auto & pet : pets)
+	{
+		insert.reset();
+		bind_pet(insert, 1, pet);
+		insert.step();
+
+		last_id.reset();
+		last_id.step();
+		ids.push_back(last_id.column_int64(0));
+	}
+}
+
+void
+insert_with_returning(
+	database_t & db, const std::vector<pet_t> & pets, ids_t & ids)
+{
+	statement_t insert{db.handle(),
+			std::string{single_row_insert_sql} + " returning id"};
+
+	for(const auto & pet : pets)
+	{
+		insert.reset();
+		bind_pet(insert, 1, pet);
+		insert.step();
+		// The statement is reset before the next row like it's done
+		// by statement_reset_guard_t in db_layer_t.
+		ids.push_back(insert.column_int64(0));
+	}
+}
+
+void
+insert_with_c_api_rowid(
+	database_t & db, const std::vector<pet_t> & pets, ids_t & ids)
+{
+	statement_t insert{db.handle(), single_row_insert_sql};
+
+	for(const auto & pet : pets)
+	{
+		insert.reset();
+		bind_pet(insert, 1, pet);
+		insert.step();
+		ids.push_back(sqlite3_last_insert_rowid(db.handle()));
+	}
+}
+
+void
+insert_multi_row(
+	database_t & db, const std::vector<pet_t> & pets, ids_t & ids)
+{
+	const std::size_t sizes[] = { 256u, 64u, 16u };
+
+	auto current = pets.begin();
+	const auto end = pets.end();
+	for(const auto rows_count : sizes)
+	{
+		std::string sql{"insert into pets(name, type, owner, picture) values"};
+		for(std::size_t i = 0u; i != rows_count; ++i)
+			sql += i ? ",(?,?,?,?)" : "(?,?,?,?)";
+		statement_t insert{db.handle(), sql};
+
+		while(static_cast<std::size_t>(std::distance(current, end)) >= rows_count)
+		{
+			insert.reset();
+			int index = 1;
+			for(std::size_t i = 0u; i != rows_count; ++i, ++current, index += 4)
+				bind_pet(insert, index, *current);
+			insert.step();
+
+			const auto last = sqlite3_last_insert_rowid(db.handle());
+			for(auto id = last - static_cast<std::int64_t>(rows_count) + 1;
+					id <= last; ++id)
+				ids.push_back(id);
+		}
+	}
+
+	insert_with_c_api_rowid(
+			db, std::vector<pet_t>(current, end), ids);
+}
+
+template<typename Insert>
+void
+run_case(
+	const char * name,
+	const std::string & file_name,
+	const std::vector<pet_t> & pets,
+	Insert insert)
+{
+	const auto seconds = crud_example::bench::measure([&] {
+			database_t db{file_name};
+			ids_t ids;
+			ids.reserve(pets.size());
+
+			db.exec("begin");
+			insert(db, pets, ids);
+			db.exec("commit");
+
+			if(ids.size() != pets.size() ||
+					ids.back() != static_cast<std::int64_t>(pets.size()))
+				throw std::runtime_error("unexpected IDs");
+		});
+
+	std::printf("%-30s %10.1f %14.0f\n", name, seconds * 1e3,
+			static_cast<double>(pets.size()) / seconds);
+}
+
+} /* namespace anonymous */
+
+int
+main(int argc, char ** argv)
+{
+	const auto pets_count =
+			crud_example::bench::size_arg(argc, argv, 1, 100000u);
+	const std::string file_name{argc > 2 ? argv[2] : "bench_bulk_insert.db3"};
+
+	std::vector<pet_t> pets;
+	pets.reserve(pets_count);
+	for(std::size_t i = 0u; i != pets_count; ++i)
+		pets.push_back(pet_t{
+				"Pet #" + std::to_string(i), "dog", "John Smith", "pet.jpg"});
+
+	std::printf("SQLite %s, pets: %zu\n", sqlite3_libversion(), pets_count);
+	std::printf("%-30s %10s %14s\n", "case", "ms", "pets/s");
+
+	run_case("select last_insert_rowid()", file_name, pets,
+			insert_with_select_rowid);
+	if(sqlite3_libversion_number() >= 3035000)
+		run_case("returning id", file_name, pets, insert_with_returning);
+	run_case("sqlite3_last_insert_rowid()", file_name, pets,
+			insert_with_c_api_rowid);
+	run_case("multi-row inserts", file_name, pets, insert_multi_row);
+
+	std::remove(file_name.c_str());
+
+	return 0;
+}
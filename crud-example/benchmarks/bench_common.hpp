@@ -0,0 +1,62 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace crud_example
+{
+
+namespace bench
+{
+
+// The count of runs of every case. The median is reported.
+const std::size_t default_runs = 5u;
+
+// Runs action several times and returns the median duration
+// in seconds.
+template<typename F>
+double
+measure(F && action, std::size_t runs = default_runs)
+{
+	std::vector<double> durations;
+	durations.reserve(runs);
+	for(std::size_t i = 0u; i != runs; ++i)
+	{
+		const auto started_at = std::chrono::steady_clock::now();
+		action();
+		durations.push_back(std::chrono::duration<double>(
+				std::chrono::steady_clock::now() - started_at).count());
+	}
+
+	std::sort(durations.begin(), durations.end());
+	return durations[durations.size() / 2u];
+}
+
+// Returns the value of a numeric command-line argument or
+// default_value if it isn't specified.
+inline std::size_t
+size_arg(int argc, char ** argv, int index, std::size_t default_value)
+{
+	if(index < argc)
+		return static_cast<std::size_t>(std::strtoull(argv[index], nullptr, 10));
+	return default_value;
+}
+
+// Lanes of lanes_message_queue_t for items of benchmarks: the lane
+// of an item is in its m_lane member. Lanes is cost_lanes_t or another
+// type with count and weight() for lanes_message_queue_t.
+template<typename Lanes, typename T>
+struct member_lanes_t : public Lanes
+{
+	static std::size_t
+	lane(const T & item) noexcept { return item.m_lane; }
+};
+
+} /* namespace bench */
+
+} /* namespace crud_example */
+
@@ -0,0 +1,193 @@
+// Throughput of RESTinio IO with 1, 2, 4, ... IO threads.
+//
+// The server has the same routes as the application, with the same
+// express_router_t and traits, but every handler answers right on
+// the IO thread with a small JSON body. So only the work of IO threads
+// is measured: accepting of connections, parsing of requests, regex
+// matching of routes and writing of responses.
+//
+// The load is generated by client threads in the same process. Every
+// client has its own keep-alive connection and sends the next request
+// after the response to the previous one is read. Requests go to all
+// routes in turn. Clients share CPU cores with the server, so cores
+// should be more than IO threads + clients for meaningful numbers.
+//
+// Usage: bench_io_threads [max_io_threads] [clients] [requests_per_client] [port]
+
+#include "bench_common.hpp"
+
+#include <restinio/all.hpp>
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace
+{
+
+using router_t = restinio::router::express_router_t<>;
+
+// The same traits as in the application.
+struct bench_traits_t : public restinio::default_traits_t
+{
+	using request_handler_t = router_t;
+};
+
+auto
+make_router()
+{
+	auto router = std::make_unique<router_t>();
+
+	const auto reply = [](const auto & req, const auto &) {
+			return req->create_response()
+				.append_header(restinio::http_field::content_type,
+						"application/json")
+				.set_body(R"({"id":1,"name":"Bunny","type":"dog"})")
+				.done();
+		};
+
+	router->http_get("/all/v1/pets", reply);
+	router->http_post("/all/v1/pets", reply);
+	router->http_post("/all/v1/pets/bulk", reply);
+	router->http_get("/all/v1/pets/batch-upload-form", reply);
+	router->http_get(R"--(/all/v1/pets/:id(\d+))--", reply);
+	router->add_handler(
+			restinio::http_method_patch(),
+			R"--(/all/v1/pets/:id(\d+))--", reply);
+	router->http_delete(R"--(/all/v1/pets/:id(\d+))--", reply);
+	router->http_get("/metrics", reply);
+
+	return router;
+}
+
+// Requests of clients, for routes with and without the :id parameter.
+const char * const requests[] = {
+	"GET /all/v1/pets/42 HTTP/1.1\r\nHost: localhost\r\n\r\n",
+	"GET /all/v1/pets HTTP/1.1\r\nHost: localhost\r\n\r\n",
+	"PATCH /all/v1/pets/42 HTTP/1.1\r\nHost: localhost\r\n"
+		"Content-Length: 2\r\n\r\n{}",
+	"POST /all/v1/pets HTTP/1.1\r\nHost: localhost\r\n"
+		"Content-Length: 2\r\n\r\n{}",
+	"DELETE /all/v1/pets/42 HTTP/1.1\r\nHost: localhost\r\n\r\n",
+};
+
+// Sends requests_count requests via one keep-alive connection.
+void
+run_client(unsigned short port, std::size_t requests_count)
+{
+	namespace asio = restinio::asio_ns;
+
+	asio::io_context io_context;
+	asio::ip::tcp::socket socket{io_context};
+	socket.connect(asio::ip::tcp::endpoint{
+			asio::ip::make_address("127.0.0.1"), port});
+	socket.set_option(asio::ip::tcp::no_delay{true});
+
+	asio::streambuf response;
+	for(std::size_t i = 0u; i != requests_count; ++i)
+	{
+		const std::string request{
+				requests[i % (sizeof(requests) / sizeof(requests[0]))]};
+		asio::write(socket, asio::buffer(request));
+
+		const auto header_size = asio::read_until(socket, response, "\r\n\r\n");
+		const std::string header{
+				asio::buffers_begin(response.data()),
+				asio::buffers_begin(response.data()) + header_size};
+		response.consume(header_size);
+
+		if(0u != header.find("HTTP/1.1 200"))
+			throw std::runtime_error("unexpected response: " + header);
+
+		const auto length_pos = header.find("Content-Length: ");
+		if(std::string::npos == length_pos)
+			throw std::runtime_error("no Content-Length in response");
+		const auto body_size = static_cast<std::size_t>(
+				std::stoul(header.substr(length_pos + 16u)));
+
+		if(response.size() < body_size)
+			asio::read(socket, response,
+					asio::transfer_exactly(body_size - response.size()));
+		response.consume(body_size);
+	}
+}
+
+// Returns the duration of processing of all requests in seconds.
+double
+run_case(
+	std::size_t io_threads_count,
+	std::size_t clients_count,
+	std::size_t requests_per_client,
+	unsigned short port)
+{
+	// The server is started by run_async() because the main thread
+	// drives clients. It's the same as on_thread_pool() of
+	// the application, with 1 thread it's the same as on_this_thread().
+	auto server = restinio::run_async(
+			restinio::own_io_context(),
+			restinio::server_settings_t<bench_traits_t>{}
+				.port(port)
+				.address("127.0.0.1")
+				.request_handler(make_router()),
+			io_threads_count);
+
+	const auto seconds = crud_example::bench::measure([&] {
+			std::atomic<bool> failed{false};
+			std::vector<std::thread> clients;
+			for(std::size_t i = 0u; i != clients_count; ++i)
+				clients.emplace_back([&] {
+						try
+						{
+							run_client(port, requests_per_client);
+						}
+						catch(const std::exception & x)
+						{
+							std::fprintf(stderr, "client failed: %s\n", x.what());
+							failed = true;
+						}
+					});
+
+			for(auto & t : clients)
+				t.join();
+
+			if(failed)
+				throw std::runtime_error("some clients failed");
+		});
+
+	server->stop();
+	server->wait();
+
+	return seconds;
+}
+
+} /* namespace anonymous */
+
+int
+main(int argc, char ** argv)
+{
+	using crud_example::bench::size_arg;
+
+	const auto max_io_threads = size_arg(argc, argv, 1, 8u);
+	const auto clients_count = size_arg(argc, argv, 2, 16u);
+	const auto requests_per_client = size_arg(argc, argv, 3, 10000u);
+	const auto port = static_cast<unsigned short>(size_arg(argc, argv, 4, 8081u));
+
+	std::printf("hardware threads: %u, clients: %zu, requests per client: %zu\n",
+			std::thread::hardware_concurrency(),
+			clients_count,
+			requests_per_client);
+	std::printf("%-12s %10s %14s\n", "IO threads", "ms", "requests/s");
+
+	for(std::size_t threads = 1u; threads <= max_io_threads; threads *= 2u)
+	{
+		const auto seconds = run_case(
+				threads, clients_count, requests_per_client, port);
+		std::printf("%-12zu %10.1f %14.0f\n", threads, seconds * 1e3,
+				static_cast<double>(clients_count * requests_per_client) /
+						seconds);
+	}
+
+	return 0;
+}
@@ -0,0 +1,116 @@
+// Parsing of generated batch uploads with 10k, 100k and 1M pets
+// by the streaming parser and by the parallel one.
+//
+// The streaming case is parse_bunch_of_pets() on the current thread.
+// The parallel case is split_pets_array() and parse_pets_fragment()
+// for every part on a separate thread, then the parts are merged in
+// the order of the document. It's the same as
+// request_processor_t::parse_bunch_of_pets_in_parallel() does on
+// worker threads.
+//
+// Usage: bench_pets_parsing [max_parts]
+
+#include "bench_common.hpp"
+
+#include "../pets_json_parser.hpp"
+
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+using namespace crud_example;
+
+namespace
+{
+
+std::string
+make_document(std::size_t pets_count)
+{
+	std::string document{R"({"pets":[)"};
+	document.reserve(pets_count * 96u);
+	for(std::size_t i = 0u; i != pets_count; ++i)
+	{
+		if(i)
+			document += ',';
+		document += R"({"name":"Pet #)";
+		document += std::to_string(i);
+		document += R"(","type":"dog","owner":"John Smith","picture":"pet.jpg"})";
+	}
+	document += "]}";
+
+	return document;
+}
+
+std::size_t
+parse_streaming(const std::string & document)
+{
+	std::size_t count = 0u;
+	parse_bunch_of_pets(document.data(), document.size(), 256u,
+			[&count](std::vector<model::pet_without_id_t> & pets) {
+				count += pets.size();
+			});
+
+	return count;
+}
+
+std::size_t
+parse_parallel(const std::string & document, std::size_t parts_count)
+{
+	const auto fragments = split_pets_array(
+			document.data(), document.size(), parts_count);
+
+	std::vector<std::vector<model::pet_without_id_t>> parts(fragments.size());
+	std::vector<std::thread> threads;
+	for(std::size_t i = 1u; i < fragments.size(); ++i)
+		threads.emplace_back([&, i] {
+				parts[i] = parse_pets_fragment(fragments[i]);
+			});
+	if(!fragments.empty())
+		parts[0] = parse_pets_fragment(fragments[0]);
+
+	for(auto & t : threads)
+		t.join();
+
+	std::vector<model::pet_without_id_t> pets;
+	for(auto & part : parts)
+		std::move(part.begin(), part.end(), std::back_inserter(pets));
+
+	return pets.size();
+}
+
+} /* namespace anonymous */
+
+int
+main(int argc, char ** argv)
+{
+	const auto max_parts = bench::size_arg(argc, argv, 1, 8u);
+
+	std::printf("hardware threads: %u\n", std::thread::hardware_concurrency());
+	std::printf("%-10s %-10s %-12s %10s %12s\n",
+			"pets", "size, MiB", "mode", "ms", "MiB/s");
+
+	for(const std::size_t pets_count : {10000u, 100000u, 1000000u})
+	{
+		const auto document = make_document(pets_count);
+		const auto mib = static_cast<double>(document.size()) / (1024.0 * 1024.0);
+
+		const auto report = [&](const std::string & mode, double seconds) {
+				std::printf("%-10zu %-10.1f %-12s %10.1f %12.1f\n",
+						pets_count, mib, mode.c_str(), seconds * 1e3, mib / seconds);
+			};
+
+		report("streaming", bench::measure([&] {
+				if(pets_count != parse_streaming(document))
+					throw std::runtime_error("unexpected count of pets");
+			}));
+
+		for(std::size_t parts = 1u; parts <= max_parts; parts *= 2u)
+			report("parallel/" + std::to_string(parts), bench::measure([&] {
+					if(pets_count != parse_parallel(document, parts))
+						throw std::runtime_error("unexpected count of pets");
+				}));
+	}
+
+	return 0;
+}
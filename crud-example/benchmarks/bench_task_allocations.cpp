@@ -0,0 +1,156 @@
+// Count of memory allocations on creation of a task and on pushing
+// it into every kind of task queue.
+//
+// Allocations are counted by counting_allocations.hpp. Tasks are
+// made like tasks of the application: the callable captures two
+// pointers and receives the request (a shared_ptr) from the item.
+// For comparison std::function captures the request too, as tasks
+// were made before fixed_size_task_t.
+//
+// Queues are created with the capacity of tasks_count, like queues of
+// the application are created with their limits.
+//
+// Usage: bench_task_allocations [tasks_count]
+
+#include "bench_common.hpp"
+#include "counting_allocations.hpp"
+
+#include "../multithreading.hpp"
+
+#include <functional>
+#include <memory>
+
+using namespace crud_example;
+
+namespace
+{
+
+using request_t = std::shared_ptr<int>;
+
+using fixed_task_t = fixed_size_task_t<2u * sizeof(void *), const request_t &>;
+
+// The counterpart of task_t from main.cpp.
+struct item_t
+{
+	fixed_task_t m_task;
+	request_t m_req;
+	std::size_t m_lane{0u};
+};
+
+// The counterpart of task_lanes_t from main.cpp.
+using item_lanes_t = bench::member_lanes_t<cost_lanes_t, item_t>;
+
+// Makes a callable like ones that are pushed by the application.
+auto
+make_callable(int * processor, int * metrics)
+{
+	return [processor, metrics](const request_t & req) {
+			*processor += *req + *metrics;
+		};
+}
+
+template<typename F>
+double
+allocations_per_task(std::size_t tasks_count, F && action)
+{
+	return static_cast<double>(bench::count_allocations(action)) /
+			static_cast<double>(tasks_count);
+}
+
+// Allocations of creation of tasks of both kinds.
+void
+measure_creation(std::size_t tasks_count)
+{
+	const auto req = std::make_shared<int>(1);
+	int processor = 0;
+	int metrics = 0;
+
+	const auto function_allocs = allocations_per_task(tasks_count, [&] {
+			for(std::size_t i = 0u; i != tasks_count; ++i)
+			{
+				std::function<void()> task{
+						[req, callable = make_callable(&processor, &metrics)] {
+							callable(req);
+						}};
+				task();
+			}
+		});
+
+	const auto fixed_allocs = allocations_per_task(tasks_count, [&] {
+			for(std::size_t i = 0u; i != tasks_count; ++i)
+			{
+				fixed_task_t task{make_callable(&processor, &metrics)};
+				task(req);
+			}
+		});
+
+	std::printf("%-32s %12.3f\n", "std::function", function_allocs);
+	std::printf("%-32s %12.3f\n", "fixed_size_task_t", fixed_allocs);
+}
+
+// Allocations of push() in two modes:
+// - steady: every push is followed by pop, the queue is almost empty;
+// - burst: tasks_count tasks are pushed and only then popped.
+// The queue is created before the measurement.
+template<typename Queue>
+void
+measure_queue(const char * name, std::size_t tasks_count)
+{
+	const auto req = std::make_shared<int>(1);
+	int processor = 0;
+	int metrics = 0;
+
+	auto make_item = [&](std::size_t i) {
+		item_t item;
+		item.m_task = fixed_task_t{make_callable(&processor, &metrics)};
+		item.m_req = req;
+		item.m_lane = i % 5u ? 0u : 1u;
+		return item;
+	};
+
+	Queue queue{tasks_count};
+	item_t receiver;
+
+	const auto steady_allocs = allocations_per_task(tasks_count, [&] {
+			for(std::size_t i = 0u; i != tasks_count; ++i)
+			{
+				queue.push(make_item(i));
+				queue.pop(receiver);
+			}
+		});
+
+	const auto burst_allocs = allocations_per_task(tasks_count, [&] {
+			for(std::size_t i = 0u; i != tasks_count; ++i)
+				queue.push(make_item(i));
+			for(std::size_t i = 0u; i != tasks_count; ++i)
+				queue.pop(receiver);
+		});
+
+	std::printf("%-32s %12.3f %12.3f\n", name, steady_allocs, burst_allocs);
+}
+
+} /* namespace anonymous */
+
+int
+main(int argc, char ** argv)
+{
+	// push() of the lock-free queue waits if it's full, so the burst
+	// can't be bigger than the capacity.
+	const auto tasks_count = bench::size_arg(argc, argv, 1, 4096u);
+
+	std::printf("tasks: %zu\n\n", tasks_count);
+	std::printf("%-32s %12s\n", "task", "allocs/task");
+	measure_creation(tasks_count);
+
+	std::printf("\n%-32s %12s %12s\n", "queue", "steady", "burst");
+	measure_queue<message_queue_t<item_t>>(
+			"message_queue_t", tasks_count);
+	measure_queue<lanes_message_queue_t<item_t, item_lanes_t>>(
+			"lanes_message_queue_t (default)", tasks_count);
+	measure_queue<lock_free_message_queue_t<item_t>>(
+			"lock_free_message_queue_t", tasks_count);
+	measure_queue<work_stealing_queue_t<item_t>>(
+			"work_stealing_queue_t", tasks_count);
+
+	return 0;
+}
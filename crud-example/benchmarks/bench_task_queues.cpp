@@ -0,0 +1,111 @@
+// Throughput of message_queue_t and lock_free_message_queue_t.
+//
+// Producers push items and consumers pop them until the queue is
+// closed. The case of one producer and three consumers is the same
+// as in the application: the IO thread and three worker threads.
+//
+// Usage: bench_task_queues [items_count]
+
+#include "bench_common.hpp"
+
+#include "../multithreading.hpp"
+
+#include <thread>
+
+using namespace crud_example;
+
+namespace
+{
+
+// An item of the size of task_t's payload: a request handle and
+// two pointers.
+struct item_t
+{
+	void * m_data[4];
+};
+
+// An item that tells a consumer to stop.
+item_t
+make_stop_item() noexcept
+{
+	item_t item{};
+	item.m_data[0] = &item;
+	return item;
+}
+
+template<typename Queue>
+double
+run_case(
+	std::size_t producers,
+	std::size_t consumers,
+	std::size_t items_count)
+{
+	return bench::measure([&] {
+		Queue queue;
+
+		std::vector<std::thread> consumer_threads;
+		for(std::size_t i = 0u; i != consumers; ++i)
+			consumer_threads.emplace_back([&] {
+				item_t item;
+				while(pop_result_t::extracted == queue.pop(item) &&
+						nullptr == item.m_data[0])
+				{}
+			});
+
+		std::vector<std::thread> producer_threads;
+		for(std::size_t i = 0u; i != producers; ++i)
+			producer_threads.emplace_back([&, i] {
+				const auto count = items_count / producers +
+						(i < items_count % producers ? 1u : 0u);
+				for(std::size_t n = 0u; n != count; ++n)
+					queue.push(item_t{});
+			});
+
+		for(auto & t : producer_threads)
+			t.join();
+
+		// Stop items go after all ordinary items, so every consumer
+		// stops when all items are extracted.
+		for(std::size_t i = 0u; i != consumers; ++i)
+			queue.push(make_stop_item());
+
+		for(auto & t : consumer_threads)
+			t.join();
+	});
+}
+
+} /* namespace anonymous */
+
+int
+main(int argc, char ** argv)
+{
+	const auto items_count = bench::size_arg(argc, argv, 1, 1000000u);
+
+	struct case_t
+	{
+		std::size_t m_producers;
+		std::size_t m_consumers;
+	};
+	const case_t cases[] = { {1u, 1u}, {1u, 3u}, {4u, 4u} };
+
+	std::printf("hardware threads: %u, items: %zu\n",
+			std::thread::hardware_concurrency(), items_count);
+	std::printf("%-10s %-10s %18s %18s\n",
+			"producers", "consumers", "mutex, Mitems/s", "lock-free, Mitems/s");
+
+	for(const auto & c : cases)
+	{
+		const auto mutex_time = run_case<message_queue_t<item_t>>(
+				c.m_producers, c.m_consumers, items_count);
+		const auto lock_free_time = run_case<lock_free_message_queue_t<item_t>>(
+				c.m_producers, c.m_consumers, items_count);
+
+		std::printf("%-10zu %-10zu %18.2f %18.2f\n",
+				c.m_producers, c.m_consumers,
+				static_cast<double>(items_count) / mutex_time / 1e6,
+				static_cast<double>(items_count) / lock_free_time / 1e6);
+	}
+
+	return 0;
+}
+
@@ -0,0 +1,132 @@
+// Throughput of worker pools from 1 to 32 threads with
+// work_stealing_queue_t and with a single shared queue (message_queue_t
+// and lanes_message_queue_t, the default queue of the application).
+//
+// Workloads:
+// - "external": all tasks are pushed by one thread that isn't
+//   a worker, like requests from the IO thread;
+// - "fork": every external task pushes several subtasks from a worker
+//   thread, like the parallel parsing of a batch upload.
+//
+// Every task performs a small amount of computations.
+//
+// Usage: bench_work_stealing [tasks_count] [max_workers]
+
+#include "bench_common.hpp"
+
+#include "../multithreading.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+using namespace crud_example;
+
+namespace
+{
+
+// The count of subtasks of every external task in the "fork" workload.
+const std::size_t subtasks_count = 4u;
+
+// The count of iterations of the computations of a task.
+const unsigned work_iterations = 256u;
+
+// Subtasks go to the lane of expensive tasks.
+const std::size_t subtask_lane = 1u;
+
+struct task_t
+{
+	std::uint32_t m_seed{0u};
+	std::size_t m_lane{0u};
+};
+
+using task_lanes_t = bench::member_lanes_t<cost_lanes_t, task_t>;
+
+std::atomic<std::uint32_t> g_sink{0u};
+
+void
+do_work(std::uint32_t seed)
+{
+	for(unsigned i = 0u; i != work_iterations; ++i)
+		seed = seed * 1664525u + 1013904223u;
+	g_sink.fetch_xor(seed & 1u, std::memory_order_relaxed);
+}
+
+// Returns the duration of processing of all tasks in seconds.
+template<typename Queue>
+double
+run_case(std::size_t workers_count, std::size_t tasks_count, bool fork)
+{
+	return bench::measure([&] {
+		Queue queue;
+		const auto expected = fork ?
+				tasks_count * (1u + subtasks_count) : tasks_count;
+		std::atomic<std::size_t> completed{0u};
+
+		std::vector<std::thread> workers;
+		for(std::size_t i = 0u; i != workers_count; ++i)
+			workers.emplace_back([&] {
+				task_t task;
+				while(pop_result_t::extracted == queue.pop(task))
+				{
+					if(fork && subtask_lane != task.m_lane)
+						for(std::size_t s = 0u; s != subtasks_count; ++s)
+							queue.push(task_t{
+									task.m_seed + static_cast<std::uint32_t>(s),
+									subtask_lane});
+
+					do_work(task.m_seed);
+					completed.fetch_add(1u, std::memory_order_relaxed);
+				}
+			});
+
+		for(std::size_t i = 0u; i != tasks_count; ++i)
+			queue.push(task_t{static_cast<std::uint32_t>(i), 0u});
+
+		while(completed.load(std::memory_order_relaxed) != expected)
+			std::this_thread::yield();
+
+		queue.close();
+		for(auto & t : workers)
+			t.join();
+	});
+}
+
+} /* namespace anonymous */
+
+int
+main(int argc, char ** argv)
+{
+	const auto tasks_count = bench::size_arg(argc, argv, 1, 200000u);
+	const auto max_workers = bench::size_arg(argc, argv, 2, 32u);
+
+	std::printf("hardware threads: %u, external tasks: %zu\n",
+			std::thread::hardware_concurrency(), tasks_count);
+	std::printf("%-10s %-8s %16s %16s %16s\n", "workload", "workers",
+			"shared, Mt/s", "lanes, Mt/s", "stealing, Mt/s");
+
+	for(const bool fork : {false, true})
+	{
+		const auto total = static_cast<double>(fork ?
+				tasks_count * (1u + subtasks_count) : tasks_count);
+
+		for(std::size_t workers = 1u; workers <= max_workers; workers *= 2u)
+		{
+			const auto shared = run_case<message_queue_t<task_t>>(
+					workers, tasks_count, fork);
+			const auto lanes = run_case<lanes_message_queue_t<task_t, task_lanes_t>>(
+					workers, tasks_count, fork);
+			const auto stealing = run_case<work_stealing_queue_t<task_t>>(
+					workers, tasks_count, fork);
+
+			std::printf("%-10s %-8zu %16.2f %16.2f %16.2f\n",
+					fork ? "fork" : "external", workers,
+					total / shared / 1e6,
+					total / lanes / 1e6,
+					total / stealing / 1e6);
+		}
+	}
+
+	return 0;
+}
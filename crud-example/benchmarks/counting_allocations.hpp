@@ -0,0 +1,56 @@
+#pragma once
+
+// Replaces the global operator new by a counting one.
+//
+// NOTE: it should be included only into one translation unit of
+// a benchmark executable.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace crud_example
+{
+
+namespace bench
+{
+
+// The count of calls of the global operator new.
+static std::atomic<std::size_t> g_allocations{0u};
+
+// Returns the count of allocations made by action.
+template<typename F>
+std::size_t
+count_allocations(F && action)
+{
+	const auto before = g_allocations.load(std::memory_order_relaxed);
+	action();
+	return g_allocations.load(std::memory_order_relaxed) - before;
+}
+
+} /* namespace bench */
+
+} /* namespace crud_example */
+
+void *
+operator new(std::size_t size)
+{
+	crud_example::bench::g_allocations.fetch_add(
+			1u, std::memory_order_relaxed);
+	if(void * p = std::malloc(size ? size : 1u))
+		return p;
+	throw std::bad_alloc{};
+}
+
+void
+operator delete(void * p) noexcept
+{
+	std::free(p);
+}
+
+void
+operator delete(void * p, std::size_t) noexcept
+{
+	std::free(p);
+}
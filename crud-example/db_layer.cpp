@@ -1,12 +1,149 @@
 #include "db_layer.hpp"
 
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
 namespace crud_example
 {
 
+namespace
+{
+
+// How long a connection waits for locks held by other connections
+// before SQLITE_BUSY is reported.
+const int busy_timeout_ms = 5000;
+
+const char *
+to_pragma_value(synchronous_mode_t mode) noexcept
+{
+	switch(mode)
+	{
+	case synchronous_mode_t::off: return "OFF";
+	case synchronous_mode_t::normal: return "NORMAL";
+	case synchronous_mode_t::full: return "FULL";
+	}
+
+	return "FULL";
+}
+
+void
+setup_journal_mode(SQLite::Database & db, const db_params_t & params)
+{
+	if(journal_mode_t::wal == params.m_journal_mode)
+	{
+		db.exec("pragma journal_mode = WAL;");
+		db.exec(std::string{"pragma synchronous = "} +
+				to_pragma_value(params.m_wal.m_synchronous) + ";");
+		db.exec("pragma wal_autocheckpoint = " +
+				std::to_string(params.m_wal.m_wal_autocheckpoint) + ";");
+		db.exec("pragma journal_size_limit = " +
+				std::to_string(params.m_wal.m_journal_size_limit) + ";");
+	}
+	else
+		// WAL mode is persistent, so it should be turned off explicitly
+		// if the DB was used in WAL mode before.
+		db.exec("pragma journal_mode = DELETE;");
+}
+
+// Helper for resetting a statement at the end of the scope.
+//
+// A statement that isn't reset holds the read transaction
+// (and prevents checkpoints in WAL mode).
+class statement_reset_guard_t
+{
+	SQLite::Statement & m_stmt;
+
+public:
+	statement_reset_guard_t(SQLite::Statement & stmt) noexcept
+		:	m_stmt{stmt}
+	{}
+
+	~statement_reset_guard_t() noexcept
+	{
+		try
+		{
+			m_stmt.reset();
+		}
+		catch(...)
+		{}
+	}
+};
+
+// Counts of rows in multi-row insert statements.
+// Should be in descending order.
+const std::size_t multi_row_insert_sizes[] = { 256u, 64u, 16u };
+
+// The count of bound parameters for one row in the insert statement.
+const int params_per_inserted_row = 4;
+
+std::string
+make_multi_row_insert_sql(std::size_t rows_count)
+{
+	std::string sql{"insert into pets(name, type, owner, picture) values"};
+	sql.reserve(sql.size() + rows_count * 11u);
+	for(std::size_t i = 0u; i != rows_count; ++i)
+	{
+		if(i)
+			sql += ',';
+		sql += "(?,?,?,?)";
+	}
+	sql += ';';
+
+	return sql;
+}
+
+// Makes a reference to the content of a column.
+// It's valid until the next step of the statement.
+model::string_ref_t
+column_ref(const SQLite::Column & column)
+{
+	// NOTE: getText() has to be called before getBytes().
+	const char * data = column.getText();
+	return model::string_ref_t{
+			data, static_cast<std::size_t>(column.getBytes())};
+}
+
+// Makes a view of the pet from the current row of a statement.
+// Columns should go as: id, name, type, owner, picture.
+model::pet_view_t
+make_pet_view(SQLite::Statement & stmt)
+{
+	return model::pet_view_t{
+			stmt.getColumn(0).getInt(),
+			column_ref(stmt.getColumn(1)),
+			column_ref(stmt.getColumn(2)),
+			column_ref(stmt.getColumn(3)),
+			column_ref(stmt.getColumn(4))
+		};
+}
+
+// Copies the content of a column into the arena.
+model::string_ref_t
+copy_column(monotonic_arena_t & arena, const SQLite::Column & column)
+{
+	const auto source = column_ref(column);
+	auto * data = static_cast<char *>(arena.allocate(source.m_size, 1u));
+	std::memcpy(data, source.m_data, source.m_size);
+
+	return model::string_ref_t{data, source.m_size};
+}
+
+} /* namespace anonymous */
+
 db_layer_t::db_with_tables_t::db_with_tables_t(
-	const char * database_name)
-	:	m_db{database_name, SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE}
+	const db_params_t & params)
+	:	m_db{params.m_database_name,
+			SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE}
 {
+	// Readers use separate connections to the same DB, so
+	// the writer has to wait while a reader holds a lock.
+	m_db.setBusyTimeout(busy_timeout_ms);
+
+	setup_journal_mode(m_db, params);
+
 	// Create the main table if it is not here yet.
 	m_db.exec(R"sql(
 			create table if not exists pets(
@@ -18,18 +155,12 @@ db_layer_t::db_with_tables_t::db_with_tables_t(
 		)sql");
 }
 
-db_layer_t::db_layer_t(const char * database_name)
-	:	m_db{database_name}
+db_layer_t::writer_connection_t::writer_connection_t(
+	const db_params_t & params)
+	:	m_db{params}
 	,	m_create_new_stmt{m_db,
 			R"sql(insert into pets(name, type, owner, picture)
 					values(:name, :type, :owner, :picture);)sql"}
-	,	m_last_insert_rowid_stmt{m_db,
-			R"sql(select last_insert_rowid();)sql"}
-	,	m_get_all_pets_stmt{m_db,
-			R"sql(select id, name, type, owner, picture from pets;)sql"}
-	,	m_get_pet_stmt{m_db,
-			R"sql(select id, name, type, owner, picture from pets
-					where id = :id;)sql"}
 	,	m_update_pet_stmt{m_db,
 			R"sql(update pets set
 						name = :name,
@@ -40,107 +171,343 @@ db_layer_t::db_layer_t(const char * database_name)
 	,	m_delete_pet_stmt{m_db,
 			R"sql(delete from pets where id = :id)sql"}
 {
+	// A statement can't have more parameters than the limit of
+	// the SQLite library (it's 999 for versions before 3.32.0).
+	const auto max_params = sqlite3_limit(
+			m_db.db().getHandle(), SQLITE_LIMIT_VARIABLE_NUMBER, -1);
+
+	for(const auto rows_count : multi_row_insert_sizes)
+		if(static_cast<long long>(rows_count) * params_per_inserted_row <=
+				max_params)
+			m_multi_row_inserts.push_back(multi_row_insert_t{
+					rows_count,
+					std::make_unique<SQLite::Statement>(
+							m_db, make_multi_row_insert_sql(rows_count))
+				});
 }
 
-pet_id_t
-db_layer_t::create_new_pet(const model::pet_without_id_t & pet)
+db_layer_t::reader_connection_t::reader_connection_t(
+	const db_params_t & params)
+	:	m_db{params.m_database_name, SQLite::OPEN_READONLY, busy_timeout_ms}
+	,	m_get_all_pets_stmt{m_db,
+			R"sql(select id, name, type, owner, picture from pets;)sql"}
+	,	m_get_pets_page_stmt{m_db,
+			R"sql(select id, name, type, owner, picture from pets
+					where id > :after_id order by id limit :limit;)sql"}
+	,	m_get_pet_stmt{m_db,
+			R"sql(select id, name, type, owner, picture from pets
+					where id = :id;)sql"}
+{
+}
+
+db_layer_t::acquired_reader_t::acquired_reader_t(db_layer_t & owner)
+	:	m_owner{owner}
+	,	m_connection{owner.acquire_reader()}
+{
+}
+
+db_layer_t::acquired_reader_t::~acquired_reader_t() noexcept
+{
+	m_owner.release_reader(m_connection);
+}
+
+db_layer_t::db_layer_t(const db_params_t & params)
+	:	m_cache{params.m_cache}
+	,	m_writer{params}
+	,	m_group_commit{params.m_group_commit}
+	,	m_write_queue_params{params.m_write_queue}
+{
+
+	const auto readers_count = params.m_readers_count ?
+			params.m_readers_count : 1u;
+
+	m_readers.reserve(readers_count);
+	m_free_readers.reserve(readers_count);
+	for(std::size_t i = 0u; i != readers_count; ++i)
+	{
+		m_readers.push_back(std::make_unique<reader_connection_t>(params));
+		m_free_readers.push_back(m_readers.back().get());
+	}
+
+	m_writer_thread = std::thread{[this]{ writer_thread_body(); }};
+}
+
+db_layer_t::~db_layer_t() noexcept
+{
+	stop();
+}
+
+void
+db_layer_t::stop() noexcept
+{
+	{
+		std::lock_guard<std::mutex> lock{m_write_queue_lock};
+		m_writer_shutdown = true;
+	}
+	m_write_queue_not_empty.notify_one();
+
+	// All pending operations will be completed before the writer
+	// thread finishes.
+	if(m_writer_thread.joinable())
+		m_writer_thread.join();
+}
+
+void
+db_layer_t::async_create_new_pet(
+	model::pet_without_id_t pet,
+	write_completion_handler_t<pet_id_t> handler)
+{
+	// The data is shared between the action and the commit hook.
+	auto data = std::make_shared<model::pet_data_t>(std::move(pet.m_data));
+	schedule_write<pet_id_t>(
+			write_kind_t::single_pet,
+			[this, data] { return do_create_new_pet(*data); },
+			[this, data](pet_id_t id) {
+				m_cache.put(id, model::pet_with_id_t{id, *data});
+			},
+			std::move(handler));
+}
+
+void
+db_layer_t::async_create_bunch_of_pets(
+	model::bunch_of_pets_without_id_t pets,
+	write_completion_handler_t<model::bunch_of_pet_ids_t> handler)
+{
+	// Chunks are never dropped, their count is limited by callers.
+	schedule_write<model::bunch_of_pet_ids_t>(
+			write_kind_t::chunk,
+			[this, pets = std::move(pets)] {
+				return do_create_bunch_of_pets(pets);
+			},
+			[](const model::bunch_of_pet_ids_t &) {},
+			std::move(handler));
+}
+
+cache_stats_t
+db_layer_t::cache_stats() const
+{
+	return m_cache.stats();
+}
+
+std::size_t
+db_layer_t::write_queue_size() const
+{
+	std::lock_guard<std::mutex> lock{m_write_queue_lock};
+	return m_write_queue_size;
+}
+
+void
+db_layer_t::async_update_pet(
+	pet_id_t id,
+	model::pet_without_id_t pet,
+	write_completion_handler_t<update_result_t> handler)
+{
+	// The data is shared between the action and the commit hook.
+	auto data = std::make_shared<model::pet_data_t>(std::move(pet.m_data));
+	schedule_write<update_result_t>(
+			write_kind_t::single_pet,
+			[this, id, data] { return do_update_pet(id, *data); },
+			[this, id, data](update_result_t result) {
+				if(update_result_t::updated == result)
+					m_cache.put(id, model::pet_with_id_t{id, *data});
+				else
+					m_cache.erase(id);
+			},
+			std::move(handler));
+}
+
+void
+db_layer_t::async_delete_pet(
+	pet_id_t id,
+	write_completion_handler_t<delete_result_t> handler)
 {
-	std::lock_guard<std::mutex> lock{m_lock};
+	schedule_write<delete_result_t>(
+			write_kind_t::single_pet,
+			[this, id] { return do_delete_pet(id); },
+			[this, id](delete_result_t) { m_cache.erase(id); },
+			std::move(handler));
+}
 
-	m_create_new_stmt.reset();
-	m_create_new_stmt.clearBindings();
+pet_id_t
+db_layer_t::do_create_new_pet(const model::pet_data_t & pet)
+{
+	auto & stmt = m_writer.m_create_new_stmt;
 
-	m_create_new_stmt.bindNoCopy(":name", pet.m_data.m_name);
-	m_create_new_stmt.bindNoCopy(":type", pet.m_data.m_type);
-	m_create_new_stmt.bindNoCopy(":owner", pet.m_data.m_owner);
-	m_create_new_stmt.bindNoCopy(":picture", pet.m_data.m_picture);
+	stmt.reset();
+	stmt.clearBindings();
 
-	m_create_new_stmt.exec();
+	stmt.bindNoCopy(":name", pet.m_name);
+	stmt.bindNoCopy(":type", pet.m_type);
+	stmt.bindNoCopy(":owner", pet.m_owner);
+	stmt.bindNoCopy(":picture", pet.m_picture);
 
-	m_last_insert_rowid_stmt.reset();
-	m_last_insert_rowid_stmt.executeStep();
+	stmt.exec();
 
-	return m_last_insert_rowid_stmt.getColumn(0);
+	// The ID is taken via the C handle without running another
+	// statement. It's faster than RETURNING clause because SQLite
+	// collects rows for RETURNING into a temporary table
+	// (see benchmarks/bench_bulk_insert.cpp).
+	return static_cast<pet_id_t>(
+			sqlite3_last_insert_rowid(m_writer.m_db.db().getHandle()));
 }
 
 model::bunch_of_pet_ids_t
-db_layer_t::create_bunch_of_pets(
+db_layer_t::do_create_bunch_of_pets(
 	const model::bunch_of_pets_without_id_t & pets)
 {
 	model::bunch_of_pet_ids_t result;
+	result.m_ids.reserve(pets.m_pets.size());
 
-	std::lock_guard<std::mutex> lock{m_lock};
+	do_insert_pets(pets.m_pets, result.m_ids);
 
-	SQLite::Transaction trx{m_db};
+	return result;
+}
 
-	for(const auto & current : pets.m_pets)
+void
+db_layer_t::do_insert_pets(
+	const std::vector<model::pet_without_id_t> & pets,
+	std::vector<pet_id_t> & ids)
+{
+	auto current = pets.begin();
+	const auto end = pets.end();
+
+	// Pets are inserted by the largest possible chunks.
+	for(auto & insert : m_writer.m_multi_row_inserts)
 	{
-		m_create_new_stmt.reset();
-		m_create_new_stmt.clearBindings();
+		auto & stmt = *insert.m_stmt;
+		while(static_cast<std::size_t>(std::distance(current, end)) >=
+				insert.m_rows_count)
+		{
+			stmt.reset();
+			stmt.clearBindings();
+
+			int index = 1;
+			for(std::size_t i = 0u; i != insert.m_rows_count; ++i, ++current)
+			{
+				const auto & pet = current->m_data;
+				stmt.bindNoCopy(index++, pet.m_name);
+				stmt.bindNoCopy(index++, pet.m_type);
+				stmt.bindNoCopy(index++, pet.m_owner);
+				stmt.bindNoCopy(index++, pet.m_picture);
+			}
+
+			stmt.exec();
+
+			// All writes are performed by the single writer connection,
+			// so the rows of one statement get consecutive IDs.
+			const auto last_id = static_cast<pet_id_t>(
+					sqlite3_last_insert_rowid(m_writer.m_db.db().getHandle()));
+			const auto first_id = static_cast<pet_id_t>(
+					last_id - static_cast<pet_id_t>(insert.m_rows_count) + 1);
+			for(auto id = first_id; id <= last_id; ++id)
+				ids.push_back(id);
+		}
+	}
 
-		m_create_new_stmt.bindNoCopy(":name", current.m_data.m_name);
-		m_create_new_stmt.bindNoCopy(":type", current.m_data.m_type);
-		m_create_new_stmt.bindNoCopy(":owner", current.m_data.m_owner);
-		m_create_new_stmt.bindNoCopy(":picture", current.m_data.m_picture);
+	// The remainder is inserted one by one.
+	for(; current != end; ++current)
+		ids.push_back(do_create_new_pet(current->m_data));
+}
 
-		m_create_new_stmt.exec();
+model::arena_pets_t
+db_layer_t::get_all_pets(monotonic_arena_t & arena)
+{
+	model::arena_pets_t result{arena_allocator_t<model::pet_view_t>{arena}};
+
+	acquired_reader_t conn{*this};
+	auto & stmt = conn->m_get_all_pets_stmt;
+
+	stmt.reset();
+	statement_reset_guard_t reset_guard{stmt};
+	while(stmt.executeStep())
+		result.push_back(model::pet_view_t{
+				stmt.getColumn(0).getInt(),
+				copy_column(arena, stmt.getColumn(1)),
+				copy_column(arena, stmt.getColumn(2)),
+				copy_column(arena, stmt.getColumn(3)),
+				copy_column(arena, stmt.getColumn(4))
+			});
 
-		m_last_insert_rowid_stmt.reset();
-		m_last_insert_rowid_stmt.executeStep();
+	return result;
+}
 
-		result.m_ids.push_back(m_last_insert_rowid_stmt.getColumn(0));
-	}
+void
+db_layer_t::for_each_pet(const pet_handler_t & handler)
+{
+	acquired_reader_t conn{*this};
+	auto & stmt = conn->m_get_all_pets_stmt;
 
-	trx.commit();
+	stmt.reset();
+	statement_reset_guard_t reset_guard{stmt};
 
-	return result;
+	while(stmt.executeStep())
+		handler(make_pet_view(stmt));
 }
 
-model::all_pets_t
-db_layer_t::get_all_pets()
+nonstd::optional<pet_id_t>
+db_layer_t::for_each_pet_in_page(
+	pet_id_t after_id,
+	std::size_t limit,
+	const pet_handler_t & handler)
 {
-	model::all_pets_t result;
+	acquired_reader_t conn{*this};
+	auto & stmt = conn->m_get_pets_page_stmt;
+
+	stmt.reset();
+	stmt.clearBindings();
+	statement_reset_guard_t reset_guard{stmt};
 
-	std::lock_guard<std::mutex> lock{m_lock};
+	stmt.bind(":after_id", after_id);
+	// One extra row tells us whether there is the next page.
+	stmt.bind(":limit", static_cast<int>(limit) + 1);
 
-	m_get_all_pets_stmt.reset();
-	while(m_get_all_pets_stmt.executeStep())
+	std::size_t count = 0u;
+	pet_id_t last_id = after_id;
+	while(stmt.executeStep())
 	{
-		model::pet_with_id_t pet;
-		pet.m_id = m_get_all_pets_stmt.getColumn(0);
-		pet.m_data.m_name = m_get_all_pets_stmt.getColumn(1).getString();
-		pet.m_data.m_type = m_get_all_pets_stmt.getColumn(2).getString();
-		pet.m_data.m_owner = m_get_all_pets_stmt.getColumn(3).getString();
-		pet.m_data.m_picture = m_get_all_pets_stmt.getColumn(4).getString();
+		if(count == limit)
+			return last_id;
 
-		result.m_pets.push_back(std::move(pet));
+		const auto pet = make_pet_view(stmt);
+		handler(pet);
+
+		last_id = pet.m_id;
+		++count;
 	}
 
-	return result;
+	return nonstd::nullopt;
 }
 
 nonstd::optional<model::pet_with_id_t>
 db_layer_t::get_pet(pet_id_t id)
 {
-	nonstd::optional<model::pet_with_id_t> result;
+	auto result = m_cache.find(id);
+	if(result)
+		return result;
+
+	// The ticket has to be taken before reading from the DB.
+	const auto cache_ticket = m_cache.get_insert_ticket(id);
 
-	std::lock_guard<std::mutex> lock{m_lock};
+	acquired_reader_t conn{*this};
+	auto & stmt = conn->m_get_pet_stmt;
 
-	m_get_pet_stmt.reset();
-	m_get_pet_stmt.clearBindings();
+	stmt.reset();
+	stmt.clearBindings();
+	statement_reset_guard_t reset_guard{stmt};
 
-	m_get_pet_stmt.bind(":id", id);
+	stmt.bind(":id", id);
 
-	if(m_get_pet_stmt.executeStep())
+	if(stmt.executeStep())
 	{
 		model::pet_with_id_t pet;
 
-		pet.m_id = m_get_pet_stmt.getColumn(0);
-		pet.m_data.m_name = m_get_pet_stmt.getColumn(1).getString();
-		pet.m_data.m_type = m_get_pet_stmt.getColumn(2).getString();
-		pet.m_data.m_owner = m_get_pet_stmt.getColumn(3).getString();
-		pet.m_data.m_picture = m_get_pet_stmt.getColumn(4).getString();
+		pet.m_id = stmt.getColumn(0);
+		pet.m_data.m_name = stmt.getColumn(1).getString();
+		pet.m_data.m_type = stmt.getColumn(2).getString();
+		pet.m_data.m_owner = stmt.getColumn(3).getString();
+		pet.m_data.m_picture = stmt.getColumn(4).getString();
 
+		m_cache.insert(cache_ticket, id, pet);
 		result = std::move(pet);
 	}
 
@@ -148,36 +515,253 @@ db_layer_t::get_pet(pet_id_t id)
 }
 
 db_layer_t::update_result_t
-db_layer_t::update_pet(pet_id_t id, const model::pet_without_id_t & pet)
+db_layer_t::do_update_pet(pet_id_t id, const model::pet_data_t & pet)
 {
-	std::lock_guard<std::mutex> lock{m_lock};
+	auto & stmt = m_writer.m_update_pet_stmt;
 
-	m_update_pet_stmt.reset();
-	m_update_pet_stmt.clearBindings();
+	stmt.reset();
+	stmt.clearBindings();
 
-	m_update_pet_stmt.bindNoCopy(":name", pet.m_data.m_name);
-	m_update_pet_stmt.bindNoCopy(":type", pet.m_data.m_type);
-	m_update_pet_stmt.bindNoCopy(":owner", pet.m_data.m_owner);
-	m_update_pet_stmt.bindNoCopy(":picture", pet.m_data.m_picture);
-	m_update_pet_stmt.bind(":id", id);
+	stmt.bindNoCopy(":name", pet.m_name);
+	stmt.bindNoCopy(":type", pet.m_type);
+	stmt.bindNoCopy(":owner", pet.m_owner);
+	stmt.bindNoCopy(":picture", pet.m_picture);
+	stmt.bind(":id", id);
 
-	return 1 == m_update_pet_stmt.exec() ?
+	return 1 == stmt.exec() ?
 			update_result_t::updated : update_result_t::not_found;
 }
 
 db_layer_t::delete_result_t
-db_layer_t::delete_pet(pet_id_t id)
+db_layer_t::do_delete_pet(pet_id_t id)
 {
-	std::lock_guard<std::mutex> lock{m_lock};
+	auto & stmt = m_writer.m_delete_pet_stmt;
 
-	m_delete_pet_stmt.reset();
-	m_delete_pet_stmt.clearBindings();
+	stmt.reset();
+	stmt.clearBindings();
 
-	m_delete_pet_stmt.bind(":id", id);
+	stmt.bind(":id", id);
 
-	return 1 == m_delete_pet_stmt.exec() ?
+	return 1 == stmt.exec() ?
 			delete_result_t::deleted : delete_result_t::not_found;
 }
 
+db_layer_t::reader_connection_t &
+db_layer_t::acquire_reader()
+{
+	std::unique_lock<std::mutex> lock{m_pool_lock};
+	m_reader_released.wait(lock,
+			[this]{ return !m_free_readers.empty(); });
+
+	auto * connection = m_free_readers.back();
+	m_free_readers.pop_back();
+
+	return *connection;
+}
+
+void
+db_layer_t::release_reader(reader_connection_t & connection) noexcept
+{
+	{
+		std::lock_guard<std::mutex> lock{m_pool_lock};
+		m_free_readers.push_back(&connection);
+	}
+	m_reader_released.notify_one();
+}
+
+void
+db_layer_t::push_write_op(write_op_t op)
+{
+	if(write_kind_t::single_pet == op.m_kind)
+		op.m_deadline = std::chrono::steady_clock::now() +
+				m_write_queue_params.m_max_wait;
+
+	// The reason of the rejection of the new operation if it isn't
+	// accepted.
+	const char * rejection_reason = nullptr;
+	nonstd::optional<write_op_t> shed;
+	bool should_notify = false;
+	{
+		std::lock_guard<std::mutex> lock{m_write_queue_lock};
+
+		// Chunks are always accepted. Only operations for single pets
+		// are rejected or shed.
+		auto & single_pets =
+				m_write_lanes[static_cast<std::size_t>(write_kind_t::single_pet)];
+		if(m_writer_shutdown)
+			// Nobody will perform the operation after the stop.
+			rejection_reason = "the DB writer is stopped";
+		else if(write_kind_t::single_pet == op.m_kind &&
+				m_write_queue_params.m_capacity <= m_write_queue_size)
+		{
+			if(overflow_policy_t::reject_new == m_write_queue_params.m_policy ||
+					single_pets.empty())
+				rejection_reason = "the queue of the DB writer is full";
+			else
+			{
+				shed = std::move(single_pets.front());
+				single_pets.pop_front();
+				--m_write_queue_size;
+			}
+		}
+
+		if(!rejection_reason)
+		{
+			m_write_lanes[static_cast<std::size_t>(op.m_kind)].push_back(
+					std::move(op));
+			++m_write_queue_size;
+
+			// The writer should be woken up if it is sleeping on the
+			// empty queue or waits for the batch to be filled up.
+			should_notify = 1u == m_write_queue_size ||
+					m_group_commit.m_max_batch_size <= m_write_queue_size;
+		}
+	}
+
+	if(should_notify)
+		m_write_queue_not_empty.notify_one();
+
+	// Completions are called without the lock because they send
+	// responses.
+	if(rejection_reason)
+		reject_write_op(op, rejection_reason);
+	if(shed)
+		reject_write_op(*shed, "dropped from the full queue of the DB writer");
+}
+
+void
+db_layer_t::reject_write_op(write_op_t & op, const char * reason) noexcept
+{
+	// NOTE: exceptions from completion handlers are ignored the same
+	// way as in perform_write_batch().
+	try
+	{
+		op.m_completion(std::make_exception_ptr(write_rejected_t{reason}));
+	}
+	catch(...)
+	{}
+}
+
+void
+db_layer_t::writer_thread_body()
+{
+	std::vector<write_op_t> batch;
+	batch.reserve(m_group_commit.m_max_batch_size);
+
+	while(extract_write_batch(batch))
+	{
+		perform_write_batch(batch);
+		batch.clear();
+	}
+}
+
+bool
+db_layer_t::extract_write_batch(std::vector<write_op_t> & batch)
+{
+	const auto max_batch_size = m_group_commit.m_max_batch_size ?
+			m_group_commit.m_max_batch_size : 1u;
+
+	std::unique_lock<std::mutex> lock{m_write_queue_lock};
+
+	if(!m_write_queue_size)
+	{
+		m_write_queue_not_empty.wait(lock,
+				[this]{ return m_writer_shutdown || 0u != m_write_queue_size; });
+		if(!m_write_queue_size)
+			return false;
+
+		// The writer was idle, so it's worth waiting a bit for
+		// operations that will be committed together with the first one.
+		// There is no need to wait if operations were accumulated
+		// while the previous transaction was in progress.
+		m_write_queue_not_empty.wait_for(lock, m_group_commit.m_max_delay,
+				[&]{
+					return m_writer_shutdown ||
+							max_batch_size <= m_write_queue_size;
+				});
+	}
+
+	const auto count = std::min(max_batch_size, m_write_queue_size);
+	for(std::size_t i = 0u; i != count; ++i)
+		batch.push_back(extract_write_op());
+
+	return true;
+}
+
+db_layer_t::write_op_t
+db_layer_t::extract_write_op()
+{
+	auto & lane = m_write_lanes[m_write_round_robin.select(
+			[this](std::size_t l) { return m_write_lanes[l].empty(); })];
+
+	auto op = std::move(lane.front());
+	lane.pop_front();
+	--m_write_queue_size;
+	return op;
+}
+
+void
+db_layer_t::perform_write_batch(std::vector<write_op_t> & batch)
+{
+	// Operations that waited too long are rejected without touching
+	// the DB: their clients have likely given up already.
+	const auto now = std::chrono::steady_clock::now();
+	const auto expired = std::stable_partition(batch.begin(), batch.end(),
+			[now](const write_op_t & op) { return now <= op.m_deadline; });
+	for(auto it = expired; it != batch.end(); ++it)
+		reject_write_op(*it, "waited too long in the queue of the DB writer");
+	batch.erase(expired, batch.end());
+
+	if(batch.empty())
+		return;
+
+	std::vector<std::exception_ptr> errors(batch.size());
+
+	try
+	{
+		auto & db = m_writer.m_db.db();
+		SQLite::Transaction trx{db};
+
+		// Every operation is performed inside its own savepoint, so
+		// a failure of one operation doesn't affect others.
+		for(std::size_t i = 0u; i != batch.size(); ++i)
+		{
+			db.exec("savepoint write_op;");
+			try
+			{
+				batch[i].m_action();
+				db.exec("release write_op;");
+			}
+			catch(...)
+			{
+				errors[i] = std::current_exception();
+				db.exec("rollback to write_op; release write_op;");
+			}
+		}
+
+		trx.commit();
+	}
+	catch(...)
+	{
+		// The transaction has been rolled back, all operations failed.
+		const auto error = std::current_exception();
+		for(auto & e : errors)
+			if(!e)
+				e = error;
+	}
+
+	for(std::size_t i = 0u; i != batch.size(); ++i)
+	{
+		// NOTE: because this is just example we ignore exceptions from
+		// completion handlers. They shouldn't stop the writer thread.
+		try
+		{
+			batch[i].m_completion(errors[i]);
+		}
+		catch(...)
+		{}
+	}
+}
+
 } /* namespace crud_example */
 
@@ -5,12 +5,153 @@
 #include <nonstd/optional.hpp>
 
 #include "pet_data_types.hpp"
+#include "lru_cache.hpp"
+#include "multithreading.hpp"
 
+#include <array>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 namespace crud_example
 {
 
+// Journaling mode to be used for the DB.
+enum class journal_mode_t
+{
+	// The default SQLite's rollback journal. Readers are blocked
+	// while a writer commits a transaction.
+	rollback,
+	// Write-ahead log. Readers don't wait for the writer.
+	wal
+};
+
+// Possible values for 'PRAGMA synchronous'.
+enum class synchronous_mode_t
+{
+	off,
+	normal,
+	full
+};
+
+// Parameters to be applied to the DB in WAL mode.
+struct wal_params_t
+{
+	// NORMAL is safe in WAL mode: a crash can lose the last
+	// transactions but can't corrupt the DB.
+	synchronous_mode_t m_synchronous{synchronous_mode_t::normal};
+
+	// The size of WAL (in pages) that triggers automatic checkpoint.
+	int m_wal_autocheckpoint{1000};
+
+	// The limit for the size of WAL file left after checkpoint
+	// (in bytes, negative value means no limit).
+	std::int64_t m_journal_size_limit{-1};
+};
+
+// Parameters for group commit of write operations.
+//
+// Write operations are performed by a separate writer thread.
+// Operations that arrive while the writer is busy (or within
+// m_max_delay after the first one if the writer is idle) are
+// committed in one transaction.
+struct group_commit_params_t
+{
+	// Max count of operations to be committed in one transaction.
+	std::size_t m_max_batch_size{64u};
+
+	// How long an idle writer waits for more operations
+	// before starting a transaction.
+	std::chrono::microseconds m_max_delay{500};
+};
+
+// Limits of the queue of operations waiting for the writer thread.
+//
+// Only operations for single pets are limited. Chunks of batch uploads
+// and bulk imports are always accepted and never expire: a request
+// has a few chunks in flight at most and the request fails if one of
+// its chunks is lost.
+struct write_queue_params_t
+{
+	// Max count of operations in the queue.
+	std::size_t m_capacity{256u};
+
+	// What to do with a new operation if the queue is full.
+	overflow_policy_t m_policy{overflow_policy_t::reject_new};
+
+	// An operation that waited in the queue longer isn't performed.
+	std::chrono::steady_clock::duration m_max_wait{std::chrono::seconds{5}};
+};
+
+// The exception for a write operation that isn't performed because
+// the queue of the writer thread is full or the operation waited
+// in it too long.
+class write_rejected_t : public std::runtime_error
+{
+public:
+	using std::runtime_error::runtime_error;
+};
+
+// The result of an asynchronous write operation.
+//
+// Holds either a value or an exception. An attempt to get the value
+// of a failed operation rethrows the exception.
+template<typename T>
+class write_result_t
+{
+	nonstd::optional<T> m_value;
+	std::exception_ptr m_error;
+
+public:
+	write_result_t(T value) : m_value{std::move(value)} {}
+	write_result_t(std::exception_ptr error) : m_error{std::move(error)} {}
+
+	T &
+	value()
+	{
+		if(m_error)
+			std::rethrow_exception(m_error);
+		return *m_value;
+	}
+};
+
+// Type of completion handler for an asynchronous write operation.
+//
+// NOTE: completion handlers are called on the writer thread.
+template<typename T>
+using write_completion_handler_t = std::function<void(write_result_t<T>)>;
+
+// Parameters for db_layer_t.
+struct db_params_t
+{
+	std::string m_database_name;
+
+	// The count of read-only connections to the DB.
+	// It's usually equal to the count of worker threads.
+	std::size_t m_readers_count{1u};
+
+	journal_mode_t m_journal_mode{journal_mode_t::rollback};
+
+	// Used only if m_journal_mode is journal_mode_t::wal.
+	wal_params_t m_wal;
+
+	group_commit_params_t m_group_commit;
+
+	write_queue_params_t m_write_queue;
+
+	// Parameters of the cache of pets.
+	cache_params_t m_cache;
+};
+
 class db_layer_t
 {
 public:
@@ -28,25 +169,83 @@ public:
 		not_found
 	};
 
-	db_layer_t(const char * database_name);
+	db_layer_t(const db_params_t & params);
+	~db_layer_t() noexcept;
 
-	pet_id_t
-	create_new_pet(const model::pet_without_id_t & pet);
+	// Completes all pending write operations and stops the writer
+	// thread. Completion handlers aren't called after the return.
+	// New write operations are rejected with write_rejected_t.
+	//
+	// It's called by the destructor, but it should be called
+	// explicitly if completion handlers use objects that are
+	// destroyed before db_layer_t.
+	void
+	stop() noexcept;
 
-	model::bunch_of_pet_ids_t
-	create_bunch_of_pets(const model::bunch_of_pets_without_id_t & pets);
+	void
+	async_create_new_pet(
+		model::pet_without_id_t pet,
+		write_completion_handler_t<pet_id_t> handler);
+
+	void
+	async_create_bunch_of_pets(
+		model::bunch_of_pets_without_id_t pets,
+		write_completion_handler_t<model::bunch_of_pet_ids_t> handler);
 
-	model::all_pets_t
-	get_all_pets();
+	// Reads all pets. All data is allocated in the arena.
+	model::arena_pets_t
+	get_all_pets(monotonic_arena_t & arena);
+
+	// Type of handler for for_each_pet().
+	//
+	// NOTE: strings of the pet refer to the current row of the DB
+	// statement and are valid only during the call of the handler.
+	using pet_handler_t = std::function<void(const model::pet_view_t &)>;
+
+	// Calls handler for every pet in the DB.
+	//
+	// Pets are read from the DB one by one, only one pet is held
+	// in memory at a time.
+	//
+	// NOTE: a reader connection is occupied until the end of
+	// the enumeration.
+	void
+	for_each_pet(const pet_handler_t & handler);
+
+	// Calls handler for no more than limit pets with IDs greater than
+	// after_id (pets are ordered by ID).
+	//
+	// Returns the value of after_id for the next page or empty value
+	// if there are no more pets.
+	//
+	// Only limit+1 rows are read from the DB regardless of the size
+	// of the table.
+	nonstd::optional<pet_id_t>
+	for_each_pet_in_page(
+		pet_id_t after_id,
+		std::size_t limit,
+		const pet_handler_t & handler);
 
 	nonstd::optional<model::pet_with_id_t>
 	get_pet(pet_id_t id);
 
-	update_result_t
-	update_pet(pet_id_t id, const model::pet_without_id_t & pet);
+	void
+	async_update_pet(
+		pet_id_t id,
+		model::pet_without_id_t pet,
+		write_completion_handler_t<update_result_t> handler);
 
-	delete_result_t
-	delete_pet(pet_id_t id);
+	void
+	async_delete_pet(
+		pet_id_t id,
+		write_completion_handler_t<delete_result_t> handler);
+
+	cache_stats_t
+	cache_stats() const;
+
+	// The count of operations waiting for the writer thread.
+	std::size_t
+	write_queue_size() const;
 
 private:
 	// This is a special class that open a DB instance and
@@ -61,23 +260,229 @@ private:
 		SQLite::Database m_db;
 
 	public:
-		db_with_tables_t(const char * database_name);
+		db_with_tables_t(const db_params_t & params);
 
 		auto & db() noexcept { return m_db; }
 
 		operator SQLite::Database&() noexcept { return m_db; }
 	};
 
-	db_with_tables_t m_db;
+	// The only connection that modifies the DB.
+	struct writer_connection_t
+	{
+		db_with_tables_t m_db;
+
+		SQLite::Statement m_create_new_stmt;
+		SQLite::Statement m_update_pet_stmt;
+		SQLite::Statement m_delete_pet_stmt;
 
-	std::mutex m_lock;
+		// Insert statement for several rows at once.
+		struct multi_row_insert_t
+		{
+			std::size_t m_rows_count;
+			std::unique_ptr<SQLite::Statement> m_stmt;
+		};
+
+		// Multi-row inserts for creation of a bunch of pets.
+		// Sorted by the count of rows in descending order.
+		std::vector<multi_row_insert_t> m_multi_row_inserts;
+
+		writer_connection_t(const db_params_t & params);
+	};
+
+	// A read-only connection to the DB with its own set of
+	// prepared statements.
+	//
+	// A connection can be used by only one thread at a time.
+	struct reader_connection_t
+	{
+		SQLite::Database m_db;
+
+		SQLite::Statement m_get_all_pets_stmt;
+		SQLite::Statement m_get_pets_page_stmt;
+		SQLite::Statement m_get_pet_stmt;
+
+		reader_connection_t(const db_params_t & params);
+	};
+
+	// Helper for acquiring a free reader from the pool and
+	// returning it back to the pool at the end of the scope.
+	class acquired_reader_t
+	{
+		db_layer_t & m_owner;
+		reader_connection_t & m_connection;
+
+	public:
+		acquired_reader_t(db_layer_t & owner);
+		~acquired_reader_t() noexcept;
+
+		acquired_reader_t(const acquired_reader_t &) = delete;
+		acquired_reader_t(acquired_reader_t &&) = delete;
+
+		reader_connection_t * operator->() noexcept { return &m_connection; }
+	};
+
+	// Kinds of write operations. Every kind has its own lane of
+	// cost_lanes_t in the queue of the writer thread.
+	enum class write_kind_t : std::size_t
+	{
+		// Operations for a single pet. They are cheap and can be
+		// dropped if the queue is full or they wait too long.
+		single_pet,
+		// Chunks of batch uploads and bulk imports. They are expensive
+		// and are never dropped.
+		chunk
+	};
+
+	// A write operation to be performed on the writer thread.
+	struct write_op_t
+	{
+		// Performs the operation. Is called inside a transaction.
+		std::function<void()> m_action;
+
+		// Is called after the end of the transaction.
+		// Receives nullptr if the operation has been committed.
+		std::function<void(std::exception_ptr)> m_completion;
+
+		// Only operations for single pets are limited by
+		// write_queue_params_t.
+		write_kind_t m_kind{write_kind_t::single_pet};
+
+		// An operation for a single pet isn't performed after that time.
+		std::chrono::steady_clock::time_point m_deadline{
+				std::chrono::steady_clock::time_point::max()};
+	};
+
+	// Cache of pets for get_pet().
+	//
+	// It's updated by write operations after the commit.
+	// NOTE: pets created by create_bunch_of_pets() aren't put into
+	// the cache to avoid eviction of hot pets by batch uploads.
+	// IDs are never reused so the cache can't have stale values for them.
+	using pet_cache_t = sharded_lru_cache_t<pet_id_t, model::pet_with_id_t>;
+
+	mutable pet_cache_t m_cache;
+
+	// NOTE: the writer has to be created before readers because
+	// it creates the DB and switches the journal mode.
+	//
+	// The writer connection is used only by the writer thread.
+	writer_connection_t m_writer;
+
+	const group_commit_params_t m_group_commit;
+	const write_queue_params_t m_write_queue_params;
+
+	// Operations waiting for the writer thread.
+	//
+	// Lanes are served by weighted round-robin like lanes of
+	// lanes_message_queue_t: 4 operations for single pets for every
+	// chunk. So a single pet doesn't wait behind a row of chunks of
+	// a batch upload.
+	mutable std::mutex m_write_queue_lock;
+	std::condition_variable m_write_queue_not_empty;
+	std::array<std::deque<write_op_t>, cost_lanes_t::count> m_write_lanes;
+	// The count of operations in all lanes.
+	std::size_t m_write_queue_size{0u};
+	weighted_round_robin_t<cost_lanes_t> m_write_round_robin;
+	bool m_writer_shutdown{false};
+
+	std::vector<std::unique_ptr<reader_connection_t>> m_readers;
+
+	// Readers that are not used at the moment.
+	std::mutex m_pool_lock;
+	std::condition_variable m_reader_released;
+	std::vector<reader_connection_t *> m_free_readers;
+
+	reader_connection_t &
+	acquire_reader();
+
+	void
+	release_reader(reader_connection_t & connection) noexcept;
+
+	// Pushes a new operation to the writer thread.
+	//
+	// Action should return a value of type T. That value is passed to
+	// on_commit and then to handler after the commit of the transaction.
+	//
+	// An operation for a single pet can be rejected if the queue is full
+	// or if it waits too long. The handler receives write_rejected_t then.
+	template<typename T, typename Action, typename On_Commit>
+	void
+	schedule_write(
+		write_kind_t kind,
+		Action && action,
+		On_Commit && on_commit,
+		write_completion_handler_t<T> handler)
+	{
+		auto result = std::make_shared<nonstd::optional<T>>();
+		push_write_op(write_op_t{
+				[result, action = std::forward<Action>(action)]() mutable {
+					*result = action();
+				},
+				[result,
+					on_commit = std::forward<On_Commit>(on_commit),
+					handler = std::move(handler)]
+				(std::exception_ptr error) mutable {
+					if(error)
+						handler(write_result_t<T>{std::move(error)});
+					else
+					{
+						on_commit(**result);
+						handler(write_result_t<T>{std::move(**result)});
+					}
+				},
+				kind
+			});
+	}
+
+	void
+	push_write_op(write_op_t op);
+
+	// Takes the next operation from lanes by weighted round-robin.
+	//
+	// NOTE: should be called under the lock for a non-empty queue.
+	write_op_t
+	extract_write_op();
+
+	// Calls the completion of an operation that isn't performed.
+	static void
+	reject_write_op(write_op_t & op, const char * reason) noexcept;
+
+	void
+	writer_thread_body();
+
+	// Waits for the next bunch of operations to be committed together.
+	// Returns false if the writer is shut down and there is no more
+	// operations to perform.
+	bool
+	extract_write_batch(std::vector<write_op_t> & batch);
+
+	void
+	perform_write_batch(std::vector<write_op_t> & batch);
+
+	// Actual implementations of write operations.
+	// Are called on the writer thread inside a transaction.
+	pet_id_t
+	do_create_new_pet(const model::pet_data_t & pet);
+
+	model::bunch_of_pet_ids_t
+	do_create_bunch_of_pets(const model::bunch_of_pets_without_id_t & pets);
+
+	// Inserts pets and appends their IDs to ids.
+	void
+	do_insert_pets(
+		const std::vector<model::pet_without_id_t> & pets,
+		std::vector<pet_id_t> & ids);
+
+	update_result_t
+	do_update_pet(pet_id_t id, const model::pet_data_t & pet);
+
+	delete_result_t
+	do_delete_pet(pet_id_t id);
 
-	SQLite::Statement m_create_new_stmt;
-	SQLite::Statement m_last_insert_rowid_stmt;
-	SQLite::Statement m_get_all_pets_stmt;
-	SQLite::Statement m_get_pet_stmt;
-	SQLite::Statement m_update_pet_stmt;
-	SQLite::Statement m_delete_pet_stmt;
+	// NOTE: the thread is started at the end of the constructor and
+	// should be the last member of the class.
+	std::thread m_writer_thread;
 };
 
 } /* namespace crud_example */
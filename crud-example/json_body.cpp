@@ -0,0 +1,87 @@
+#include "json_body.hpp"
+
+#include <atomic>
+
+namespace crud_example
+{
+
+namespace
+{
+
+// Buffers that grew bigger are released after use to avoid holding
+// the memory of a single huge response forever.
+const std::size_t max_retained_body_size = 1024u * 1024u;
+
+} /* namespace anonymous */
+
+rapidjson::StringBuffer &
+json_body_t::start()
+{
+	m_buffer.Clear();
+	m_data = nullptr;
+
+	return m_buffer;
+}
+
+void
+json_body_t::shrink_if_too_big()
+{
+	if(max_retained_body_size < m_buffer.GetSize())
+	{
+		m_buffer.Clear();
+		m_buffer.ShrinkToFit();
+		m_data = nullptr;
+	}
+}
+
+pooled_json_serializer_t::pooled_json_serializer_t()
+	:	m_dom_buffer{new char[dom_buffer_size]}
+	,	m_dom_allocator{m_dom_buffer.get(), dom_buffer_size}
+{
+	m_bodies.reserve(max_pooled_bodies);
+}
+
+pooled_json_serializer_t &
+pooled_json_serializer_t::for_current_thread()
+{
+	static thread_local pooled_json_serializer_t serializer;
+	return serializer;
+}
+
+std::shared_ptr<json_body_t>
+pooled_json_serializer_t::acquire_body()
+{
+	std::shared_ptr<json_body_t> result;
+	for(auto & body : m_bodies)
+		if(1 == body.use_count())
+		{
+			// The last user of the body could be on another thread.
+			// Its reads of the body should happen before our writes.
+			std::atomic_thread_fence(std::memory_order_acquire);
+
+			// The memory of a huge response isn't held by the pool
+			// until the body is reused.
+			body->shrink_if_too_big();
+			if(!result)
+				result = body;
+		}
+
+	if(!result)
+	{
+		result = std::make_shared<json_body_t>();
+		if(m_bodies.size() < max_pooled_bodies)
+			m_bodies.push_back(result);
+	}
+
+	return result;
+}
+
+void
+pooled_json_serializer_t::release_dom_memory() noexcept
+{
+	// The memory in m_dom_buffer is kept, additional chunks are freed.
+	m_dom_allocator.Clear();
+}
+
+} /* namespace crud_example */
+
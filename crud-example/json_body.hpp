@@ -0,0 +1,147 @@
+#pragma once
+
+#include <json_dto/pub.hpp>
+
+#include <rapidjson/document.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace crud_example
+{
+
+// A serialized body of a response.
+//
+// It's passed to RESTinio as a shared buffer, without copying.
+class json_body_t
+{
+public:
+	using writer_t = rapidjson::Writer<rapidjson::StringBuffer>;
+
+private:
+	rapidjson::StringBuffer m_buffer;
+
+	// The pointer to the serialized value. It's obtained only once
+	// because StringBuffer::GetString() modifies the buffer.
+	const char * m_data{nullptr};
+
+public:
+	const char *
+	data() const noexcept { return m_data; }
+
+	std::size_t
+	size() const noexcept { return m_buffer.GetSize(); }
+
+	// Makes a new content of the buffer by the function that
+	// receives writer_t. The previous content is dropped but
+	// the memory of the buffer is reused.
+	template<typename F>
+	void
+	write(F && f)
+	{
+		writer_t writer{start()};
+		f(writer);
+		finish();
+	}
+
+	// Drops the previous content and returns the buffer for
+	// writing a new one.
+	rapidjson::StringBuffer &
+	start();
+
+	// Frees the memory of the buffer if it's too big to be kept
+	// for reuse. The content is dropped in that case.
+	void
+	shrink_if_too_big();
+
+	// Should be called when the new content is written.
+	void
+	finish() { m_data = m_buffer.GetString(); }
+
+	// Serializes value to the buffer.
+	void
+	assign(const rapidjson::Value & value)
+	{
+		write([&value](writer_t & writer) { value.Accept(writer); });
+	}
+};
+
+// Serializer of response bodies that reuses memory.
+//
+// There is a pool of bodies for every thread. A body from the pool
+// is reused when RESTinio doesn't hold it anymore. DOM that is built
+// by json_dto before the serialization is allocated from the memory
+// pool of the thread.
+class pooled_json_serializer_t
+{
+	// The memory for small DOMs.
+	static constexpr std::size_t dom_buffer_size = 64u * 1024u;
+
+	// The max count of bodies kept in the pool of a thread.
+	static constexpr std::size_t max_pooled_bodies = 16u;
+
+	std::unique_ptr<char[]> m_dom_buffer;
+	rapidjson::MemoryPoolAllocator<> m_dom_allocator;
+
+	std::vector<std::shared_ptr<json_body_t>> m_bodies;
+
+	pooled_json_serializer_t();
+
+	// Releases the memory allocated for a DOM.
+	void
+	release_dom_memory() noexcept;
+
+public:
+	pooled_json_serializer_t(const pooled_json_serializer_t &) = delete;
+	pooled_json_serializer_t(pooled_json_serializer_t &&) = delete;
+
+	static pooled_json_serializer_t &
+	for_current_thread();
+
+	// Returns a body that isn't used by anyone else.
+	//
+	// Huge buffers of all bodies that came back to the pool are
+	// freed here.
+	std::shared_ptr<json_body_t>
+	acquire_body();
+
+	template<typename Dto>
+	std::shared_ptr<const json_body_t>
+	serialize(const Dto & dto)
+	{
+		std::shared_ptr<json_body_t> body;
+		try
+		{
+			rapidjson::Document doc{&m_dom_allocator};
+			json_dto::json_output_t jout{doc, doc.GetAllocator()};
+			jout << dto;
+
+			body = acquire_body();
+			body->assign(doc);
+		}
+		catch(...)
+		{
+			release_dom_memory();
+			throw;
+		}
+
+		release_dom_memory();
+		return body;
+	}
+
+	// Makes a body by the function that receives json_body_t::writer_t.
+	template<typename F>
+	std::shared_ptr<const json_body_t>
+	write(F && f)
+	{
+		auto body = acquire_body();
+		body->write(std::forward<F>(f));
+		return body;
+	}
+};
+
+} /* namespace crud_example */
+
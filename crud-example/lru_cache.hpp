@@ -0,0 +1,218 @@
+#pragma once
+
+#include <nonstd/optional.hpp>
+
+#include <mutex>
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+namespace crud_example
+{
+
+// Parameters of a cache.
+struct cache_params_t
+{
+	// The max count of items in the cache. Zero disables the cache.
+	std::size_t m_capacity{0u};
+
+	std::size_t m_shards_count{16u};
+};
+
+// Statistics of a cache.
+struct cache_stats_t
+{
+	std::uint64_t m_hits{0u};
+	std::uint64_t m_misses{0u};
+	std::size_t m_size{0u};
+};
+
+// Thread-safe size-bounded LRU cache.
+//
+// Keys are distributed between several shards. Every shard has
+// its own lock and its own LRU list, so threads working with
+// different keys rarely contend.
+//
+// A value read from the storage after a miss can be stale if the
+// storage is modified in parallel. To avoid caching of stale values
+// a reader takes a ticket by get_insert_ticket() before reading from
+// the storage and then passes it to insert(). The value won't be
+// inserted if the shard has been modified after the ticket was taken.
+//
+// Cache with zero capacity is disabled: nothing is stored in it.
+template<typename Key, typename Value>
+class sharded_lru_cache_t
+{
+public:
+	// A ticket for insertion of a value after a miss.
+	using insert_ticket_t = std::uint64_t;
+
+private:
+	using item_t = std::pair<Key, Value>;
+	using items_list_t = std::list<item_t>;
+
+	struct shard_t
+	{
+		std::mutex m_lock;
+
+		// The most recently used items are at the front of the list.
+		items_list_t m_items;
+		std::unordered_map<Key, typename items_list_t::iterator> m_index;
+
+		// Is incremented on every modification of the shard.
+		insert_ticket_t m_generation{0u};
+
+		std::uint64_t m_hits{0u};
+		std::uint64_t m_misses{0u};
+	};
+
+	const std::size_t m_shard_capacity;
+	std::vector<std::unique_ptr<shard_t>> m_shards;
+
+	shard_t &
+	shard_for(const Key & key) const noexcept
+	{
+		return *m_shards[std::hash<Key>{}(key) % m_shards.size()];
+	}
+
+	// NOTE: shard's lock should be acquired.
+	void
+	insert_or_replace(shard_t & shard, Key key, Value value)
+	{
+		auto it = shard.m_index.find(key);
+		if(it != shard.m_index.end())
+		{
+			it->second->second = std::move(value);
+			shard.m_items.splice(shard.m_items.begin(), shard.m_items, it->second);
+			return;
+		}
+
+		if(shard.m_items.size() >= m_shard_capacity)
+		{
+			shard.m_index.erase(shard.m_items.back().first);
+			shard.m_items.pop_back();
+		}
+
+		shard.m_items.emplace_front(key, std::move(value));
+		shard.m_index.emplace(std::move(key), shard.m_items.begin());
+	}
+
+public:
+	sharded_lru_cache_t(const cache_params_t & params)
+		:	sharded_lru_cache_t{params.m_capacity, params.m_shards_count}
+	{}
+
+	sharded_lru_cache_t(std::size_t capacity, std::size_t shards_count)
+		:	m_shard_capacity{
+				(capacity + (shards_count ? shards_count : 1u) - 1u) /
+				(shards_count ? shards_count : 1u)}
+	{
+		m_shards.reserve(shards_count ? shards_count : 1u);
+		for(std::size_t i = 0u; i != m_shards.capacity(); ++i)
+			m_shards.push_back(std::make_unique<shard_t>());
+	}
+
+	bool
+	enabled() const noexcept { return 0u != m_shard_capacity; }
+
+	nonstd::optional<Value>
+	find(const Key & key)
+	{
+		if(!enabled())
+			return nonstd::nullopt;
+
+		auto & shard = shard_for(key);
+		std::lock_guard<std::mutex> lock{shard.m_lock};
+
+		auto it = shard.m_index.find(key);
+		if(it == shard.m_index.end())
+		{
+			++shard.m_misses;
+			return nonstd::nullopt;
+		}
+
+		++shard.m_hits;
+		shard.m_items.splice(shard.m_items.begin(), shard.m_items, it->second);
+
+		return it->second->second;
+	}
+
+	insert_ticket_t
+	get_insert_ticket(const Key & key)
+	{
+		if(!enabled())
+			return 0u;
+
+		auto & shard = shard_for(key);
+		std::lock_guard<std::mutex> lock{shard.m_lock};
+
+		return shard.m_generation;
+	}
+
+	// Inserts a value read from the storage after a miss.
+	void
+	insert(insert_ticket_t ticket, Key key, Value value)
+	{
+		if(!enabled())
+			return;
+
+		auto & shard = shard_for(key);
+		std::lock_guard<std::mutex> lock{shard.m_lock};
+
+		if(ticket == shard.m_generation)
+			insert_or_replace(shard, std::move(key), std::move(value));
+	}
+
+	// Stores a new value after the modification of the storage.
+	void
+	put(Key key, Value value)
+	{
+		if(!enabled())
+			return;
+
+		auto & shard = shard_for(key);
+		std::lock_guard<std::mutex> lock{shard.m_lock};
+
+		++shard.m_generation;
+		insert_or_replace(shard, std::move(key), std::move(value));
+	}
+
+	// Removes a value after the modification of the storage.
+	void
+	erase(const Key & key)
+	{
+		if(!enabled())
+			return;
+
+		auto & shard = shard_for(key);
+		std::lock_guard<std::mutex> lock{shard.m_lock};
+
+		++shard.m_generation;
+		auto it = shard.m_index.find(key);
+		if(it != shard.m_index.end())
+		{
+			shard.m_items.erase(it->second);
+			shard.m_index.erase(it);
+		}
+	}
+
+	cache_stats_t
+	stats() const
+	{
+		cache_stats_t result;
+		for(const auto & shard : m_shards)
+		{
+			std::lock_guard<std::mutex> lock{shard->m_lock};
+			result.m_hits += shard->m_hits;
+			result.m_misses += shard->m_misses;
+			result.m_size += shard->m_items.size();
+		}
+
+		return result;
+	}
+};
+
+} /* namespace crud_example */
+
@@ -2,29 +2,218 @@
 
 #include "multithreading.hpp"
 #include "request_processor.hpp"
+#include "metrics.hpp"
+
+#include <chrono>
 
 namespace crud_example
 {
 
+// Cost classes of requests. Every class has its own lane in the
+// queue of worker threads.
+enum class cost_class_t : std::size_t
+{
+	// Requests for a single item.
+	cheap,
+	// Requests that can process many items (lists of pets, batches).
+	expensive
+};
+
+const std::size_t cost_classes_count = 2u;
+
 // Type of message for pushing tasks to a pool of worker threads.
+//
+// Handlers from make_router() capture a reference to request_processor_t
+// and sometimes an ID of a pet. The request is passed to the callable
+// from m_req, so it isn't captured a second time. There is enough space
+// for all of them, so creation of a task doesn't allocate memory.
+// Queues don't allocate on push either while they hold no more tasks
+// than their capacity (see benchmarks/bench_task_allocations.cpp).
 struct task_t
 {
-	std::function<void()> m_task;
+	// Receives m_req, it's empty for subtasks.
+	fixed_size_task_t<
+			2u * sizeof(void *), const restinio::request_handle_t &> m_task;
+
+	// The request the task is made for. It's necessary for the
+	// response if the task is rejected. It's empty for subtasks.
+	restinio::request_handle_t m_req;
+
+	// The route of the request and the time when the task was
+	// pushed to the queue. They are necessary for metrics.
+	route_id_t m_route{};
+	std::chrono::steady_clock::time_point m_enqueued_at;
+
+	// Subtasks are parts of expensive requests.
+	cost_class_t m_cost{cost_class_t::expensive};
+
+	// The task isn't executed if it's extracted from the queue after
+	// that time. Subtasks have no deadline.
+	std::chrono::steady_clock::time_point m_deadline{
+			std::chrono::steady_clock::time_point::max()};
 
 	task_t() = default;
 
+	// Constructor for subtasks of other tasks.
 	template<typename F>
-	task_t(F && task) : m_task{std::forward<F>(task)} {}
+	task_t(route_id_t route, F && task)
+		:	m_task{std::forward<F>(task)}
+		,	m_route{route}
+		,	m_enqueued_at{std::chrono::steady_clock::now()}
+	{}
+
+	template<typename F>
+	task_t(route_id_t route, restinio::request_handle_t req, F && task)
+		:	m_task{std::forward<F>(task)}
+		,	m_req{std::move(req)}
+		,	m_route{route}
+		,	m_enqueued_at{std::chrono::steady_clock::now()}
+	{}
 };
 
+// Lanes of the queue of task_t objects: one lane for every cost class.
+// If there are both cheap and expensive tasks then 4 cheap tasks
+// are extracted for every expensive one.
+struct task_lanes_t : public cost_lanes_t
+{
+	static std::size_t
+	lane(const task_t & task) noexcept
+	{
+		return static_cast<std::size_t>(task.m_cost);
+	}
+};
+
+static_assert(cost_classes_count == task_lanes_t::count,
+		"every cost class should have its own lane");
+
 // Type of message queue of task_t objects.
-using task_queue_t = message_queue_t<task_t>;
+//
+// NOTE: cost classes are taken into account only by the default queue.
+#if defined(CRUD_EXAMPLE_LOCK_FREE_QUEUE)
+using task_queue_t = lock_free_message_queue_t<task_t>;
+#elif defined(CRUD_EXAMPLE_WORK_STEALING)
+using task_queue_t = work_stealing_queue_t<task_t>;
+#else
+using task_queue_t = lanes_message_queue_t<task_t, task_lanes_t>;
+#endif
+
+// Parameters of the admission of tasks to queues of worker threads.
+struct admission_params_t
+{
+	// Rejected requests get 503.
+	overflow_policy_t m_policy{overflow_policy_t::reject_new};
+
+	// The max time a request can wait in the queue. A request that
+	// waited longer gets 503 instead of processing: its client has
+	// likely given up already.
+	std::chrono::steady_clock::duration m_max_queue_wait{
+			std::chrono::seconds{10}};
+};
+
+// Pushes tasks from route handlers to a queue of worker threads.
+//
+// A task that doesn't fit into the queue is handled according to
+// the overflow policy. So under overload the queue doesn't grow
+// and the latency of accepted requests stays bounded.
+class task_admission_t
+{
+	task_queue_t & m_queue;
+	const admission_params_t m_params;
+	metrics_registry_t & m_metrics;
+	request_processor_t & m_processor;
+
+	void
+	reject(const task_t & task)
+	{
+		m_processor.on_overload(task.m_req, task.m_route);
+	}
+
+public:
+	task_admission_t(
+		task_queue_t & queue,
+		const admission_params_t & params,
+		metrics_registry_t & metrics,
+		request_processor_t & processor)
+		:	m_queue{queue}
+		,	m_params{params}
+		,	m_metrics{metrics}
+		,	m_processor{processor}
+	{}
+
+	task_admission_t(const task_admission_t &) = delete;
+	task_admission_t(task_admission_t &&) = delete;
+
+	void
+	push(cost_class_t cost, task_t task)
+	{
+		task.m_cost = cost;
+		task.m_deadline = task.m_enqueued_at + m_params.m_max_queue_wait;
+
+		for(;;)
+		{
+			if(m_queue.try_push(task))
+				return;
+
+			if(overflow_policy_t::reject_new == m_params.m_policy)
+				break;
+
+			task_t oldest;
+			if(!m_queue.try_pop_oldest(oldest))
+				break;
+
+			// Subtasks are just dropped, a parent task does
+			// their work itself.
+			if(oldest.m_req)
+			{
+				m_metrics.on_shed(oldest.m_route);
+				reject(oldest);
+			}
+		}
+
+		m_metrics.on_rejected(task.m_route);
+		reject(task);
+	}
+
+	// Should be called for a task extracted from the queue.
+	// Returns true if the task has missed its deadline and is
+	// rejected.
+	bool
+	reject_if_expired(
+		const task_t & task,
+		std::chrono::steady_clock::time_point now)
+	{
+		if(now <= task.m_deadline)
+			return false;
+
+		m_metrics.on_expired(task.m_route);
+		reject(task);
+		return true;
+	}
+};
+
+// A request with a big body (like a batch upload) is expensive.
+template<typename Request>
+cost_class_t
+cost_by_body_size(const Request & req)
+{
+	const std::size_t max_cheap_body_size = 64u * 1024u;
+	return req.body().size() <= max_cheap_body_size ?
+			cost_class_t::cheap : cost_class_t::expensive;
+}
 
 // Short alias for express-like router.
 using router_t = restinio::router::express_router_t<>;
 
+// Requests that only read data are processed by one pool of worker
+// threads and requests that modify data by another one. So slow
+// modifications (like batch uploads) don't delay cheap reads.
+//
+// Every route declares the cost class of its requests. Within a pool
+// cheap requests don't wait behind a row of expensive ones.
 auto make_router(
-	task_queue_t & queue,
+	task_admission_t & reads,
+	task_admission_t & writes,
+	metrics_registry_t & metrics,
 	request_processor_t & processor)
 {
 	auto router = std::make_unique<router_t>();
@@ -34,45 +223,85 @@ auto make_router(
 	//
 
 	router->http_get("/all/v1/pets",
-			[&queue, &processor](const auto & req, const auto &) {
-				queue.push(
+			[&reads, &metrics, &processor](const auto & req, const auto &) {
+				metrics.on_request(route_id_t::get_all_pets);
+				reads.push(
+					cost_class_t::expensive,
 					task_t{
-						[req, &processor] {
-							processor.on_get_all_pets(req);
+						route_id_t::get_all_pets,
+						req,
+						[&processor](const restinio::request_handle_t & task_req) {
+							processor.on_get_all_pets(task_req);
 						}
 					});
 				return restinio::request_accepted();
 			});
 
 	router->http_post("/all/v1/pets",
-			[&queue, &processor](const auto & req, const auto &) {
-				queue.push(
+			[&writes, &metrics, &processor](const auto & req, const auto &) {
+				metrics.on_request(route_id_t::create_new_pet);
+				writes.push(
+					cost_by_body_size(*req),
 					task_t{
-						[req, &processor] {
-							processor.on_create_new_pet(req);
+						route_id_t::create_new_pet,
+						req,
+						[&processor](const restinio::request_handle_t & task_req) {
+							processor.on_create_new_pet(task_req);
+						}
+					});
+				return restinio::request_accepted();
+			});
+
+	router->http_post("/all/v1/pets/bulk",
+			[&writes, &metrics, &processor](const auto & req, const auto &) {
+				metrics.on_request(route_id_t::bulk_import);
+				writes.push(
+					cost_class_t::expensive,
+					task_t{
+						route_id_t::bulk_import,
+						req,
+						[&processor](const restinio::request_handle_t & task_req) {
+							processor.on_bulk_import(task_req);
 						}
 					});
 				return restinio::request_accepted();
 			});
 
 	router->http_get("/all/v1/pets/batch-upload-form",
-			[&queue, &processor](const auto & req, const auto &) {
-				queue.push(
+			[&reads, &metrics, &processor](const auto & req, const auto &) {
+				metrics.on_request(route_id_t::batch_upload_form);
+				reads.push(
+					cost_class_t::cheap,
 					task_t{
-						[req, &processor] {
-							processor.on_make_batch_upload_form(req);
+						route_id_t::batch_upload_form,
+						req,
+						[&processor](const restinio::request_handle_t & task_req) {
+							processor.on_make_batch_upload_form(task_req);
 						}
 					});
 				return restinio::request_accepted();
 			});
 
 	router->http_get(R"--(/all/v1/pets/:id(\d+))--",
-			[&queue, &processor](const auto & req, const auto & params) {
+			[&reads, &metrics, &processor](const auto & req, const auto & params) {
 				const auto id = restinio::cast_to<pet_id_t>(params["id"]);
-				queue.push(
+				metrics.on_request(route_id_t::get_specific_pet);
+
+				// A cached body is sent right from the IO thread.
+				// Only a cache miss requires a worker thread.
+				if(processor.try_get_specific_pet_from_cache(req, id))
+				{
+					metrics.on_inline_response(route_id_t::get_specific_pet);
+					return restinio::request_accepted();
+				}
+
+				reads.push(
+					cost_class_t::cheap,
 					task_t{
-						[req, &processor, id] {
-							processor.on_get_specific_pet(req, id);
+						route_id_t::get_specific_pet,
+						req,
+						[&processor, id](const restinio::request_handle_t & task_req) {
+							processor.on_get_specific_pet(task_req, id);
 						}
 					});
 				return restinio::request_accepted();
@@ -81,34 +310,55 @@ auto make_router(
 	router->add_handler(
 			restinio::http_method_patch(),
 			R"--(/all/v1/pets/:id(\d+))--",
-			[&queue, &processor](const auto & req, const auto & params) {
+			[&writes, &metrics, &processor](const auto & req, const auto & params) {
 				const auto id = restinio::cast_to<pet_id_t>(params["id"]);
-				queue.push(
+				metrics.on_request(route_id_t::patch_specific_pet);
+				writes.push(
+					cost_class_t::cheap,
 					task_t{
-						[req, &processor, id] {
-							processor.on_patch_specific_pet(req, id);
+						route_id_t::patch_specific_pet,
+						req,
+						[&processor, id](const restinio::request_handle_t & task_req) {
+							processor.on_patch_specific_pet(task_req, id);
 						}
 					});
 				return restinio::request_accepted();
 			});
 
 	router->http_delete(R"--(/all/v1/pets/:id(\d+))--",
-			[&queue, &processor](const auto & req, const auto & params) {
+			[&writes, &metrics, &processor](const auto & req, const auto & params) {
 				const auto id = restinio::cast_to<pet_id_t>(params["id"]);
-				queue.push(
+				metrics.on_request(route_id_t::delete_specific_pet);
+				writes.push(
+					cost_class_t::cheap,
 					task_t{
-						[req, &processor, id] {
-							processor.on_delete_specific_pet(req, id);
+						route_id_t::delete_specific_pet,
+						req,
+						[&processor, id](const restinio::request_handle_t & task_req) {
+							processor.on_delete_specific_pet(task_req, id);
 						}
 					});
 				return restinio::request_accepted();
 			});
 
+	// Metrics are collected without blocking, so the response is
+	// made right on the IO thread.
+	router->http_get("/metrics",
+			[&metrics](const auto & req, const auto &) {
+				return req->create_response()
+					.append_header(restinio::http_field::content_type,
+							"text/plain; version=0.0.4")
+					.set_body(metrics.to_text())
+					.done();
+			});
+
 	return router;
 }
 
 void worker_thread_func(
-	task_queue_t & queue)	
+	task_queue_t & queue,
+	task_admission_t & admission,
+	metrics_registry_t & metrics)
 {
 	for(;;)
 	{
@@ -118,13 +368,24 @@ void worker_thread_func(
 		if(pop_result_t::queue_closed == pop_result)
 			break;
 
+		// Subtasks have no request of their own. They are counted
+		// separately to not skew the wait of requests.
+		const auto now = std::chrono::steady_clock::now();
+		metrics.on_stage(msg.m_route,
+				msg.m_req ? stage_t::queue_wait : stage_t::subtask_queue_wait,
+				now - msg.m_enqueued_at);
+
+		// There is no sense to process a request that is too late.
+		if(admission.reject_if_expired(msg, now))
+			continue;
+
 		// Extracted task should be executed.
 		// NOTE: because this is just example we don't handle
 		// exceptions from the task.
 		// In production code there should be try-catch blocks with
 		// some reaction to an exception: logging of the exception and
 		// maybe the correct shutdown of the server.
-		msg.m_task();
+		msg.m_task(msg.m_req);
 	}
 }
 
@@ -151,30 +412,137 @@ void run_application()
 {
 	using namespace crud_example;
 
-	db_layer_t db{ "pets.db3" };
-	request_processor_t processor{ db };
+	// Sizes of pools for reading and modifying requests.
+	// All modifications go through the single writer connection
+	// of the DB, so there is no need in many writing threads. But
+	// a batch upload occupies a writing thread while it's parsed and
+	// inserted by chunks, so the second thread serves other requests.
+	const std::size_t read_threads_count = 3u;
+	const std::size_t write_threads_count = 2u;
+
+	// Limits of queues of worker threads. New requests above the limits
+	// are handled according to admission_params.
+	const std::size_t read_queue_capacity = 1024u;
+	const std::size_t write_queue_capacity = 256u;
+
+	admission_params_t admission_params;
+	admission_params.m_policy = overflow_policy_t::reject_new;
+	admission_params.m_max_queue_wait = std::chrono::seconds{5};
+
+	// The count of threads for RESTinio's IO. All IO is performed on
+	// the main thread if it's 1.
+	const std::size_t io_threads_count = 1u;
+
+	// Every reading thread gets its own read-only DB connection.
+	// WAL mode allows readers to work in parallel with the writer.
+	db_params_t db_params;
+	db_params.m_database_name = "pets.db3";
+	db_params.m_readers_count = read_threads_count;
+	db_params.m_journal_mode = journal_mode_t::wal;
+	db_params.m_cache.m_capacity = 10000u;
+	// Workers of the writing pool only pass operations to the writer
+	// thread of the DB, so modifications are actually queued there.
+	// That queue is limited the same way as queues of worker threads.
+	db_params.m_write_queue.m_capacity = write_queue_capacity;
+	db_params.m_write_queue.m_policy = admission_params.m_policy;
+	db_params.m_write_queue.m_max_wait = admission_params.m_max_queue_wait;
 
-	task_queue_t queue;
-	my_thread_pool_t worker_threads_pool{
-			3,
-			my_shutdowner_t{queue},
-			worker_thread_func, std::ref(queue)
+	metrics_registry_t metrics;
+
+	task_queue_t read_queue{read_queue_capacity};
+	task_queue_t write_queue{write_queue_capacity};
+
+	db_layer_t db{ db_params };
+	request_processor_params_t processor_params;
+	processor_params.m_all_pets_mode = all_pets_response_mode_t::chunked_stream;
+	// At least one reading thread is always free for point reads
+	// even if clients read lists of pets slowly.
+	processor_params.m_max_concurrent_streams = read_threads_count - 1u;
+	// The same for writing threads: a batch upload or a bulk import
+	// waits for its chunks, so one writing thread is left for
+	// modifications of single pets.
+	processor_params.m_max_concurrent_batches = write_threads_count - 1u;
+	processor_params.m_pet_bodies_cache.m_capacity = 10000u;
+	// Uploads are parsed by the streaming parser, so pets are inserted
+	// by chunks and the whole list of pets isn't built in memory.
+	// The parallel parser can be turned on for faster parsing of big
+	// uploads at the cost of memory (up to m_max_size_for_parallel_parsing).
+	processor_params.m_batch_upload_parsing = batch_upload_parsing_t::streaming;
+	processor_params.m_parallel_parsing_parts = read_threads_count;
+	// In the parallel mode parsing of a big upload is spread over
+	// reading threads. The subtask is wrapped into shared_ptr to fit
+	// into task_t.
+	processor_params.m_subtask_executor = [&read_queue](std::function<void()> subtask) {
+			read_queue.push(
+				task_t{
+					route_id_t::create_new_pet,
+					[subtask = std::make_shared<std::function<void()>>(
+							std::move(subtask))](const restinio::request_handle_t &) {
+						(*subtask)();
+					}
+				});
+		};
+
+	request_processor_t processor{ db, metrics, processor_params };
+
+	metrics.add_cache("pets", [&db] { return db.cache_stats(); });
+	metrics.add_cache("pet_bodies",
+			[&processor] { return processor.pet_bodies_cache_stats(); });
+	metrics.add_queue("read", [&read_queue] { return read_queue.size(); });
+	metrics.add_queue("write_tasks", [&write_queue] { return write_queue.size(); });
+	metrics.add_queue("write", [&db] { return db.write_queue_size(); });
+
+	task_admission_t reads{read_queue, admission_params, metrics, processor};
+	task_admission_t writes{write_queue, admission_params, metrics, processor};
+
+	my_thread_pool_t read_threads_pool{
+			read_threads_count,
+			my_shutdowner_t{read_queue},
+			worker_thread_func,
+			std::ref(read_queue), std::ref(reads), std::ref(metrics)
+	};
+	my_thread_pool_t write_threads_pool{
+			write_threads_count,
+			my_shutdowner_t{write_queue},
+			worker_thread_func,
+			std::ref(write_queue), std::ref(writes), std::ref(metrics)
 	};
 
 	// Default traits are used as a base because they are thread-safe.
+	// It's necessary if there are several IO threads.
 	struct my_traits_t : public restinio::default_traits_t
 	{
 		using request_handler_t = router_t;
 	};
 
-	restinio::run(
-		restinio::on_this_thread<my_traits_t>()
-			.port(8080)
-			.address("localhost")
-			.request_handler(make_router(queue, processor))
-			.cleanup_func([&worker_threads_pool] {
-				worker_threads_pool.stop();
-			}));
+	// The settings are the same for both modes of running the server.
+	// The router is shared by all IO threads: it isn't modified after
+	// the creation, so matching of routes is thread-safe.
+	const auto run_server = [&](auto settings) {
+			settings
+				.port(8080)
+				.address("localhost")
+				.request_handler(
+						make_router(reads, writes, metrics, processor))
+				.cleanup_func([&read_threads_pool, &write_threads_pool, &db] {
+					// Writing threads are stopped first because they can
+					// push parsing subtasks to reading threads.
+					write_threads_pool.stop();
+					read_threads_pool.stop();
+					// Completions of pending write operations use
+					// the processor that is destroyed before the DB.
+					db.stop();
+				});
+
+			restinio::run(std::move(settings));
+		};
+
+	if(1u < io_threads_count)
+		// Accepting of connections, parsing of requests, routing and
+		// writing of responses are spread over several IO threads.
+		run_server(restinio::on_thread_pool<my_traits_t>(io_threads_count));
+	else
+		run_server(restinio::on_this_thread<my_traits_t>());
 }
 
 int main()
@@ -0,0 +1,343 @@
+#include "metrics.hpp"
+
+#include <fmt/format.h>
+
+#include <iterator>
+
+namespace crud_example
+{
+
+namespace
+{
+
+const char * const route_names[routes_count] = {
+	"get_all_pets",
+	"create_new_pet",
+	"batch_upload_form",
+	"get_specific_pet",
+	"patch_specific_pet",
+	"delete_specific_pet",
+	"bulk_import"
+};
+
+struct stage_description_t
+{
+	const char * m_metric_name;
+	const char * m_help;
+};
+
+const stage_description_t stages[stages_count] = {
+	{ "crud_queue_wait_seconds",
+		"Time spent by requests in the queue of worker threads." },
+	{ "crud_db_seconds",
+		"Time spent by requests in the DB layer." },
+	{ "crud_serialization_seconds",
+		"Time spent in serialization of response bodies." },
+	{ "crud_subtask_queue_wait_seconds",
+		"Time spent by subtasks of requests in the queue of worker threads." }
+};
+
+// Upper bounds of histogram buckets.
+const std::chrono::nanoseconds bucket_bounds[] = {
+	std::chrono::microseconds{100},
+	std::chrono::microseconds{250},
+	std::chrono::microseconds{500},
+	std::chrono::milliseconds{1},
+	std::chrono::microseconds{2500},
+	std::chrono::milliseconds{5},
+	std::chrono::milliseconds{10},
+	std::chrono::milliseconds{25},
+	std::chrono::milliseconds{50},
+	std::chrono::milliseconds{100},
+	std::chrono::milliseconds{250},
+	std::chrono::milliseconds{500},
+	std::chrono::seconds{1},
+	std::chrono::milliseconds{2500},
+	std::chrono::seconds{5},
+	std::chrono::seconds{10}
+};
+
+const char * const bucket_labels[] = {
+	"0.0001", "0.00025", "0.0005", "0.001", "0.0025", "0.005",
+	"0.01", "0.025", "0.05", "0.1", "0.25", "0.5",
+	"1", "2.5", "5", "10"
+};
+
+// Status codes with separate counters. The last slot is for
+// all other codes.
+const int tracked_status_codes[] = { 200, 400, 404, 413, 415, 500, 503 };
+
+const std::size_t tracked_status_codes_count =
+		sizeof(tracked_status_codes) / sizeof(tracked_status_codes[0]);
+
+std::size_t
+status_slot(int status_code) noexcept
+{
+	std::size_t i = 0u;
+	for(; i != tracked_status_codes_count; ++i)
+		if(tracked_status_codes[i] == status_code)
+			break;
+	return i;
+}
+
+double
+to_seconds(std::uint64_t nanoseconds) noexcept
+{
+	return static_cast<double>(nanoseconds) / 1e9;
+}
+
+} /* namespace anonymous */
+
+void
+metrics_registry_t::on_request(route_id_t route)
+{
+	counters_for_current_thread()
+		.m_requests[static_cast<std::size_t>(route)].add(1u);
+}
+
+void
+metrics_registry_t::on_response(route_id_t route, int status_code)
+{
+	static_assert(tracked_status_codes_count + 1u == status_slots_count,
+			"status_slots_count should match tracked_status_codes");
+
+	counters_for_current_thread()
+		.m_responses[static_cast<std::size_t>(route)][status_slot(status_code)]
+		.add(1u);
+}
+
+void
+metrics_registry_t::on_inline_response(route_id_t route)
+{
+	counters_for_current_thread()
+		.m_inline_responses[static_cast<std::size_t>(route)].add(1u);
+}
+
+void
+metrics_registry_t::on_rejected(route_id_t route)
+{
+	counters_for_current_thread()
+		.m_rejected[static_cast<std::size_t>(route)].add(1u);
+}
+
+void
+metrics_registry_t::on_shed(route_id_t route)
+{
+	counters_for_current_thread()
+		.m_shed[static_cast<std::size_t>(route)].add(1u);
+}
+
+void
+metrics_registry_t::on_expired(route_id_t route)
+{
+	counters_for_current_thread()
+		.m_expired[static_cast<std::size_t>(route)].add(1u);
+}
+
+void
+metrics_registry_t::on_stage(
+	route_id_t route,
+	stage_t stage,
+	duration_t duration)
+{
+	static_assert(
+			sizeof(bucket_bounds) / sizeof(bucket_bounds[0]) == buckets_count &&
+			sizeof(bucket_labels) / sizeof(bucket_labels[0]) == buckets_count,
+			"bucket_bounds and bucket_labels should have buckets_count items");
+
+	const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			duration);
+
+	std::size_t bucket = 0u;
+	while(bucket != buckets_count && bucket_bounds[bucket] < ns)
+		++bucket;
+
+	auto & histogram = counters_for_current_thread()
+			.m_histograms[static_cast<std::size_t>(route)]
+				[static_cast<std::size_t>(stage)];
+	histogram.m_buckets[bucket].add(1u);
+	histogram.m_sum.add(static_cast<std::uint64_t>(ns.count()));
+}
+
+void
+metrics_registry_t::add_cache(std::string name, cache_stats_source_t source)
+{
+	std::lock_guard<std::mutex> lock{m_lock};
+	m_caches.emplace_back(std::move(name), std::move(source));
+}
+
+void
+metrics_registry_t::add_queue(std::string name, queue_depth_source_t source)
+{
+	std::lock_guard<std::mutex> lock{m_lock};
+	m_queues.emplace_back(std::move(name), std::move(source));
+}
+
+std::string
+metrics_registry_t::to_text() const
+{
+	fmt::memory_buffer out;
+
+	std::lock_guard<std::mutex> lock{m_lock};
+
+	const auto sum_over_threads = [this](auto getter) {
+		std::uint64_t result = 0u;
+		for(const auto & t : m_threads)
+			result += getter(*t).get();
+		return result;
+	};
+
+	// Prints a family of counters with a counter for every route.
+	const auto print_route_counters = [&](
+			const char * family, const char * help,
+			const std::array<counter_t, routes_count> thread_counters_t::*field) {
+		fmt::format_to(std::back_inserter(out),
+				"# HELP {} {}\n# TYPE {} counter\n", family, help, family);
+		for(std::size_t r = 0u; r != routes_count; ++r)
+			fmt::format_to(std::back_inserter(out),
+					"{}{{route=\"{}\"}} {}\n",
+					family, route_names[r],
+					sum_over_threads([r, field](const thread_counters_t & t) -> const counter_t & {
+						return (t.*field)[r];
+					}));
+	};
+
+	print_route_counters("crud_requests_total",
+			"Count of accepted requests.",
+			&thread_counters_t::m_requests);
+	print_route_counters("crud_inline_responses_total",
+			"Count of requests answered on the IO thread without worker threads.",
+			&thread_counters_t::m_inline_responses);
+	print_route_counters("crud_rejected_requests_total",
+			"Count of requests rejected because the queue of worker threads is full.",
+			&thread_counters_t::m_rejected);
+	print_route_counters("crud_shed_requests_total",
+			"Count of requests dropped from the queue of worker threads "
+			"to make room for new ones.",
+			&thread_counters_t::m_shed);
+	print_route_counters("crud_expired_requests_total",
+			"Count of requests dropped because they waited in the queue "
+			"of worker threads longer than allowed.",
+			&thread_counters_t::m_expired);
+
+	fmt::format_to(std::back_inserter(out),
+			"# HELP crud_responses_total Count of responses by status code.\n"
+			"# TYPE crud_responses_total counter\n");
+	for(std::size_t r = 0u; r != routes_count; ++r)
+		for(std::size_t s = 0u; s != status_slots_count; ++s)
+		{
+			const auto count = sum_over_threads(
+					[r, s](const thread_counters_t & t) -> const counter_t & {
+						return t.m_responses[r][s];
+					});
+			if(!count)
+				continue;
+
+			const std::string code = s < tracked_status_codes_count ?
+					std::to_string(tracked_status_codes[s]) : std::string{"other"};
+			fmt::format_to(std::back_inserter(out),
+					"crud_responses_total{{route=\"{}\",code=\"{}\"}} {}\n",
+					route_names[r], code, count);
+		}
+
+	for(std::size_t st = 0u; st != stages_count; ++st)
+	{
+		const auto * name = stages[st].m_metric_name;
+		fmt::format_to(std::back_inserter(out),
+				"# HELP {} {}\n# TYPE {} histogram\n",
+				name, stages[st].m_help, name);
+
+		for(std::size_t r = 0u; r != routes_count; ++r)
+		{
+			std::uint64_t cumulative = 0u;
+			for(std::size_t b = 0u; b != buckets_count + 1u; ++b)
+			{
+				cumulative += sum_over_threads(
+						[r, st, b](const thread_counters_t & t) -> const counter_t & {
+							return t.m_histograms[r][st].m_buckets[b];
+						});
+				fmt::format_to(std::back_inserter(out),
+						"{}_bucket{{route=\"{}\",le=\"{}\"}} {}\n",
+						name, route_names[r],
+						b != buckets_count ? bucket_labels[b] : "+Inf",
+						cumulative);
+			}
+
+			const auto sum = sum_over_threads(
+					[r, st](const thread_counters_t & t) -> const counter_t & {
+						return t.m_histograms[r][st].m_sum;
+					});
+			fmt::format_to(std::back_inserter(out),
+					"{}_sum{{route=\"{}\"}} {}\n{}_count{{route=\"{}\"}} {}\n",
+					name, route_names[r], to_seconds(sum),
+					name, route_names[r], cumulative);
+		}
+	}
+
+	if(!m_queues.empty())
+	{
+		fmt::format_to(std::back_inserter(out),
+				"# HELP crud_queue_depth Count of tasks in the queue of worker threads.\n"
+				"# TYPE crud_queue_depth gauge\n");
+		for(const auto & q : m_queues)
+			fmt::format_to(std::back_inserter(out),
+					"crud_queue_depth{{queue=\"{}\"}} {}\n",
+					q.first, q.second());
+	}
+
+	if(!m_caches.empty())
+	{
+		std::vector<cache_stats_t> caches;
+		caches.reserve(m_caches.size());
+		for(const auto & c : m_caches)
+			caches.push_back(c.second());
+
+		const auto print_family = [&](
+				const char * family, const char * type, const char * help,
+				auto getter) {
+			fmt::format_to(std::back_inserter(out),
+					"# HELP {} {}\n# TYPE {} {}\n", family, help, family, type);
+			for(std::size_t i = 0u; i != caches.size(); ++i)
+				fmt::format_to(std::back_inserter(out),
+						"{}{{cache=\"{}\"}} {}\n",
+						family, m_caches[i].first, getter(caches[i]));
+		};
+
+		print_family("crud_cache_hits_total", "counter", "Count of cache hits.",
+				[](const cache_stats_t & s) { return s.m_hits; });
+		print_family("crud_cache_misses_total", "counter", "Count of cache misses.",
+				[](const cache_stats_t & s) { return s.m_misses; });
+		print_family("crud_cache_size", "gauge", "Count of items in cache.",
+				[](const cache_stats_t & s) { return s.m_size; });
+	}
+
+	return fmt::to_string(out);
+}
+
+metrics_registry_t::thread_counters_t &
+metrics_registry_t::counters_for_current_thread()
+{
+	// Counters of the current thread are looked up only once.
+	struct current_thread_counters_t
+	{
+		const metrics_registry_t * m_owner{nullptr};
+		thread_counters_t * m_counters{nullptr};
+	};
+	thread_local current_thread_counters_t current;
+
+	if(this != current.m_owner)
+	{
+		auto counters = std::make_unique<thread_counters_t>();
+
+		std::lock_guard<std::mutex> lock{m_lock};
+		m_threads.push_back(std::move(counters));
+
+		current.m_owner = this;
+		current.m_counters = m_threads.back().get();
+	}
+
+	return *current.m_counters;
+}
+
+} /* namespace crud_example */
+
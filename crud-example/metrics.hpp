@@ -0,0 +1,216 @@
+#pragma once
+
+#include "lru_cache.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace crud_example
+{
+
+// Routes of the application for which metrics are collected.
+enum class route_id_t : std::size_t
+{
+	get_all_pets,
+	create_new_pet,
+	batch_upload_form,
+	get_specific_pet,
+	patch_specific_pet,
+	delete_specific_pet,
+	bulk_import
+};
+
+const std::size_t routes_count = 7u;
+
+// Stages of request processing with separate latency histograms.
+enum class stage_t : std::size_t
+{
+	// Time spent in the queue of tasks for worker threads.
+	queue_wait,
+	// Time spent in db_layer_t (including the wait for the group
+	// commit for write operations).
+	db,
+	// Time spent in serialization of the response body.
+	serialization,
+	// Time spent in the queue of tasks by subtasks of a request
+	// (e.g. parts of the parallel parsing of a batch upload).
+	subtask_queue_wait
+};
+
+const std::size_t stages_count = 4u;
+
+// Collector of application metrics.
+//
+// The recording is lock-free: every thread writes into its own set of
+// counters. Those sets are merged on a scrape. The lock is acquired
+// only when a thread records something for the first time.
+class metrics_registry_t
+{
+public:
+	using duration_t = std::chrono::steady_clock::duration;
+
+	// Type of function that returns the current statistics of a cache.
+	using cache_stats_source_t = std::function<cache_stats_t()>;
+
+	// Type of function that returns the current depth of a queue.
+	using queue_depth_source_t = std::function<std::size_t()>;
+
+	metrics_registry_t() = default;
+
+	metrics_registry_t(const metrics_registry_t &) = delete;
+	metrics_registry_t(metrics_registry_t &&) = delete;
+
+	void
+	on_request(route_id_t route);
+
+	void
+	on_response(route_id_t route, int status_code);
+
+	// The request is answered right on the IO thread without
+	// passing it to worker threads.
+	void
+	on_inline_response(route_id_t route);
+
+	// The request isn't accepted because the queue of worker
+	// threads is full.
+	void
+	on_rejected(route_id_t route);
+
+	// The request is dropped from the queue of worker threads to make
+	// room for a new one.
+	void
+	on_shed(route_id_t route);
+
+	// The request is dropped by a worker thread because it has
+	// waited in the queue too long.
+	void
+	on_expired(route_id_t route);
+
+	void
+	on_stage(route_id_t route, stage_t stage, duration_t duration);
+
+	// Adds a cache whose statistics will be exported.
+	//
+	// NOTE: should be called before the start of the server.
+	void
+	add_cache(std::string name, cache_stats_source_t source);
+
+	// Adds a queue whose depth will be exported.
+	//
+	// NOTE: should be called before the start of the server.
+	void
+	add_queue(std::string name, queue_depth_source_t source);
+
+	// Makes the content for /metrics in Prometheus text format.
+	std::string
+	to_text() const;
+
+private:
+	// The count of upper bounds of histogram buckets.
+	static constexpr std::size_t buckets_count = 16u;
+
+	// Slots for status codes with separate counters
+	// plus one slot for all other codes.
+	static constexpr std::size_t status_slots_count = 8u;
+
+	// Counter that is modified only by one thread.
+	// So there is no need in atomic read-modify-write operations.
+	class counter_t
+	{
+		std::atomic<std::uint64_t> m_value{0u};
+
+	public:
+		void
+		add(std::uint64_t delta) noexcept
+		{
+			m_value.store(
+					m_value.load(std::memory_order_relaxed) + delta,
+					std::memory_order_relaxed);
+		}
+
+		std::uint64_t
+		get() const noexcept
+		{
+			return m_value.load(std::memory_order_relaxed);
+		}
+	};
+
+	struct histogram_t
+	{
+		// The last bucket is for values greater than all bounds.
+		std::array<counter_t, buckets_count + 1u> m_buckets;
+		// The sum of all values (in nanoseconds).
+		counter_t m_sum;
+	};
+
+	// Counters of one thread.
+	struct thread_counters_t
+	{
+		std::array<counter_t, routes_count> m_requests;
+		std::array<counter_t, routes_count> m_inline_responses;
+		std::array<counter_t, routes_count> m_rejected;
+		std::array<counter_t, routes_count> m_shed;
+		std::array<counter_t, routes_count> m_expired;
+		std::array<
+				std::array<counter_t, status_slots_count>,
+				routes_count > m_responses;
+		std::array<
+				std::array<histogram_t, stages_count>,
+				routes_count > m_histograms;
+	};
+
+	mutable std::mutex m_lock;
+	std::vector<std::unique_ptr<thread_counters_t>> m_threads;
+
+	std::vector<std::pair<std::string, cache_stats_source_t>> m_caches;
+	std::vector<std::pair<std::string, queue_depth_source_t>> m_queues;
+
+	thread_counters_t &
+	counters_for_current_thread();
+};
+
+// Helper for measuring the duration of a stage.
+//
+// The duration is recorded at the end of the scope.
+class stage_timer_t
+{
+	metrics_registry_t & m_metrics;
+	const route_id_t m_route;
+	const stage_t m_stage;
+	const std::chrono::steady_clock::time_point m_started_at;
+
+public:
+	stage_timer_t(
+		metrics_registry_t & metrics,
+		route_id_t route,
+		stage_t stage) noexcept
+		:	m_metrics{metrics}
+		,	m_route{route}
+		,	m_stage{stage}
+		,	m_started_at{std::chrono::steady_clock::now()}
+	{}
+
+	~stage_timer_t() noexcept
+	{
+		try
+		{
+			m_metrics.on_stage(m_route, m_stage,
+					std::chrono::steady_clock::now() - m_started_at);
+		}
+		catch(...)
+		{}
+	}
+
+	stage_timer_t(const stage_timer_t &) = delete;
+	stage_timer_t(stage_timer_t &&) = delete;
+};
+
+} /* namespace crud_example */
+
@@ -4,6 +4,16 @@
 #include <mutex>
 #include <condition_variable>
 #include <queue>
+#include <deque>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
 
 namespace crud_example
 {
@@ -73,12 +83,152 @@ public:
 	}
 };
 
+// Move-only wrapper for void(Args...) callables that holds the callable
+// inside the object itself.
+//
+// Unlike std::function it never allocates memory. An attempt to store
+// a callable that doesn't fit into Capacity bytes is a compile-time error.
+//
+// Data that is available at the call site (like the request the task
+// is made for) can be passed as Args instead of being captured, so
+// the callable is smaller.
+template<std::size_t Capacity, typename... Args>
+class fixed_size_task_t
+{
+	using storage_t = typename std::aligned_storage<
+			Capacity, alignof(std::max_align_t)>::type;
+
+	// Operations for the actual type of the stored callable.
+	struct vtable_t
+	{
+		void (*m_call)(void * what, Args... args);
+		// Constructs a new callable at `to` from the callable at `from`
+		// and destroys the callable at `from`.
+		void (*m_move)(void * from, void * to);
+		void (*m_destroy)(void * what);
+	};
+
+	template<typename F>
+	static const vtable_t *
+	vtable_for() noexcept
+	{
+		static const vtable_t vtable{
+			[](void * what, Args... args) {
+				(*static_cast<F *>(what))(std::forward<Args>(args)...);
+			},
+			[](void * from, void * to) {
+				auto * source = static_cast<F *>(from);
+				new(to) F(std::move(*source));
+				source->~F();
+			},
+			[](void * what) {
+				static_cast<F *>(what)->~F();
+			}
+		};
+
+		return &vtable;
+	}
+
+	storage_t m_storage;
+	const vtable_t * m_vtable{nullptr};
+
+	void
+	reset() noexcept
+	{
+		if(m_vtable)
+		{
+			m_vtable->m_destroy(&m_storage);
+			m_vtable = nullptr;
+		}
+	}
+
+	void
+	take_from(fixed_size_task_t & other) noexcept
+	{
+		if(other.m_vtable)
+		{
+			other.m_vtable->m_move(&other.m_storage, &m_storage);
+			m_vtable = other.m_vtable;
+			other.m_vtable = nullptr;
+		}
+	}
+
+public:
+	fixed_size_task_t() noexcept = default;
+
+	template<
+		typename F,
+		typename = typename std::enable_if<
+				!std::is_same<typename std::decay<F>::type, fixed_size_task_t>::value
+			>::type >
+	fixed_size_task_t(F && task)
+	{
+		using functor_t = typename std::decay<F>::type;
+
+		static_assert(sizeof(functor_t) <= Capacity,
+				"callable is too big for fixed_size_task_t");
+		static_assert(alignof(functor_t) <= alignof(storage_t),
+				"callable has unsupported alignment");
+		// Tasks are moved inside queues, that should never fail.
+		static_assert(std::is_nothrow_move_constructible<functor_t>::value,
+				"callable should be nothrow move constructible");
+
+		new(&m_storage) functor_t(std::forward<F>(task));
+		m_vtable = vtable_for<functor_t>();
+	}
+
+	fixed_size_task_t(const fixed_size_task_t &) = delete;
+	fixed_size_task_t & operator=(const fixed_size_task_t &) = delete;
+
+	fixed_size_task_t(fixed_size_task_t && other) noexcept
+	{
+		take_from(other);
+	}
+
+	fixed_size_task_t &
+	operator=(fixed_size_task_t && other) noexcept
+	{
+		if(this != &other)
+		{
+			reset();
+			take_from(other);
+		}
+		return *this;
+	}
+
+	~fixed_size_task_t() noexcept
+	{
+		reset();
+	}
+
+	explicit operator bool() const noexcept { return nullptr != m_vtable; }
+
+	void
+	operator()(Args... args)
+	{
+		m_vtable->m_call(&m_storage, std::forward<Args>(args)...);
+	}
+};
+
 enum class pop_result_t
 {
 	extracted,
 	queue_closed
 };
 
+// The capacity of a queue without limits.
+const std::size_t unlimited_queue_capacity = static_cast<std::size_t>(-1);
+
+// What to do with a new item if a bounded queue is full.
+enum class overflow_policy_t
+{
+	// The new item is rejected.
+	reject_new,
+	// The oldest item in the queue is rejected and the new one is
+	// added. Clients that have waited too long likely gave up already.
+	shed_oldest
+};
+
 // The very first implementation of multi-producer/multi-consumer
 // message queue.
 //
@@ -86,29 +236,73 @@ enum class pop_result_t
 //
 // If a message queue is closed all calls to pop() method will
 // return pop_result_t::queue_closed.
+//
+// The capacity is checked only by try_push(), push() always adds
+// the item. So tasks from the outside can be limited while internal
+// tasks are always accepted.
 template<typename T>
 class message_queue_t
 {
-	std::mutex m_lock;
+	mutable std::mutex m_lock;
 	std::condition_variable m_not_empty;
 
 	std::queue<T> m_queue;
 
+	const std::size_t m_capacity;
+
 	bool m_closed{false};
 
 public:
+	explicit message_queue_t(
+		std::size_t capacity = unlimited_queue_capacity)
+		:	m_capacity{capacity}
+	{}
+
 	void push(T what)
 	{
 		std::lock_guard<std::mutex> lock{m_lock};
 		if(!m_closed)
 		{
-			const bool was_empty = m_queue.empty();
 			m_queue.push(std::move(what));
-			if(was_empty)
-				m_not_empty.notify_one();
+			// Every push wakes up a consumer. Otherwise several items
+			// pushed in a row wake up just one of several consumers.
+			m_not_empty.notify_one();
 		}
 	}
 
+	// Returns false if the queue is full or closed.
+	// The item is left intact in that case.
+	bool try_push(T & what)
+	{
+		std::lock_guard<std::mutex> lock{m_lock};
+		if(m_closed || m_capacity <= m_queue.size())
+			return false;
+
+		m_queue.push(std::move(what));
+		m_not_empty.notify_one();
+
+		return true;
+	}
+
+	// Extracts the oldest item without waiting.
+	// Returns false if the queue is empty or closed.
+	bool try_pop_oldest(T & receiver)
+	{
+		std::lock_guard<std::mutex> lock{m_lock};
+		if(m_closed || m_queue.empty())
+			return false;
+
+		receiver = std::move(m_queue.front());
+		m_queue.pop();
+		return true;
+	}
+
+	std::size_t size() const
+	{
+		std::lock_guard<std::mutex> lock{m_lock};
+		return m_queue.size();
+	}
+
 	pop_result_t pop(T & receiver)
 	{
 		std::unique_lock<std::mutex> lock{m_lock};
@@ -142,5 +336,984 @@ public:
 	}
 };
 
+// FIFO queue on a ring buffer.
+//
+// The buffer is doubled when it's full and never shrinks. So pushing
+// doesn't allocate memory while the queue is no bigger than the reserved
+// capacity or than it has already been.
+//
+// T has to be DefaultConstructible and MoveAssignable.
+template<typename T>
+class ring_buffer_t
+{
+	std::unique_ptr<T[]> m_items;
+	std::size_t m_capacity{0u};
+	// The index of the first item.
+	std::size_t m_head{0u};
+	std::size_t m_size{0u};
+
+	void
+	reallocate(std::size_t capacity)
+	{
+		auto items = std::make_unique<T[]>(capacity);
+		for(std::size_t i = 0u; i != m_size; ++i)
+			items[i] = std::move(m_items[(m_head + i) % m_capacity]);
+
+		m_items = std::move(items);
+		m_capacity = capacity;
+		m_head = 0u;
+	}
+
+public:
+	void
+	reserve(std::size_t capacity)
+	{
+		if(m_capacity < capacity)
+			reallocate(capacity);
+	}
+
+	bool empty() const noexcept { return 0u == m_size; }
+
+	std::size_t size() const noexcept { return m_size; }
+
+	// NOTE: should be called for a non-empty queue.
+	T & front() noexcept { return m_items[m_head]; }
+
+	void
+	push_back(T what)
+	{
+		if(m_capacity == m_size)
+			reallocate(m_capacity ? 2u * m_capacity : 16u);
+
+		m_items[(m_head + m_size) % m_capacity] = std::move(what);
+		++m_size;
+	}
+
+	// NOTE: should be called for a non-empty queue.
+	void
+	pop_front()
+	{
+		// The slot is reset to release resources held by the item.
+		m_items[m_head] = T{};
+		m_head = (m_head + 1u) % m_capacity;
+		--m_size;
+	}
+};
+
+// Lanes for cheap and expensive items: 4 cheap items are extracted for
+// every expensive one. Lane 0 is for cheap items, lane 1 is for
+// expensive ones.
+//
+// It's the base for Lanes of lanes_message_queue_t and for the queue
+// of the DB writer.
+struct cost_lanes_t
+{
+	static constexpr std::size_t count = 2u;
+
+	static unsigned
+	weight(std::size_t lane) noexcept
+	{
+		return 0u == lane ? 4u : 1u;
+	}
+};
+
+// Weighted round-robin selection of lanes of a queue.
+//
+// Lanes is a type with static constant count and static function
+// weight(std::size_t lane) that returns a positive weight of a lane.
+// A lane gives up to its weight items in a row and then the turn goes
+// to the next non-empty lane.
+//
+// NOTE: it isn't thread-safe, it should be used under the lock of
+// the queue.
+template<typename Lanes>
+class weighted_round_robin_t
+{
+	// How many items every lane can give before the turn goes
+	// to the next lane.
+	std::array<unsigned, Lanes::count> m_credits{};
+	// The lane that has the turn.
+	std::size_t m_current{0u};
+
+public:
+	weighted_round_robin_t() noexcept
+	{
+		m_credits[0u] = Lanes::weight(0u);
+	}
+
+	// Selects the lane for the next extraction.
+	// is_empty(lane) should return true for an empty lane.
+	//
+	// NOTE: at least one lane should be non-empty.
+	template<typename Is_Empty>
+	std::size_t
+	select(Is_Empty && is_empty) noexcept
+	{
+		for(;;)
+		{
+			if(m_credits[m_current] && !is_empty(m_current))
+			{
+				--m_credits[m_current];
+				return m_current;
+			}
+
+			m_current = (m_current + 1u) % Lanes::count;
+			m_credits[m_current] = Lanes::weight(m_current);
+		}
+	}
+};
+
+// Mutex-based message queue with several lanes.
+//
+// Lanes is a type with:
+// - static constant count, the number of lanes;
+// - static function lane(const T &) that returns the lane of an item;
+// - static function weight(std::size_t lane) that returns a positive
+//   weight of a lane.
+//
+// Items of a lane are extracted in FIFO order. Lanes are served by
+// weighted_round_robin_t. So a lane full of heavy items can't block
+// items of other lanes.
+//
+// This queue has the same interface as message_queue_t and can be
+// used instead of it. The capacity is checked for all lanes together.
+// try_pop_oldest() takes the oldest item of the last non-empty lane,
+// so items of lanes with bigger indexes are dropped first.
+//
+// Every lane is a ring buffer of the whole capacity of the queue
+// allocated by the constructor. So pushing doesn't allocate memory
+// unless push() adds items above the capacity.
+//
+// T has to be DefaultConstructible and MoveAssignable.
+template<typename T, typename Lanes>
+class lanes_message_queue_t
+{
+	struct lane_t
+	{
+		ring_buffer_t<T> m_items;
+	};
+
+	mutable std::mutex m_lock;
+	std::condition_variable m_not_empty;
+
+	std::array<lane_t, Lanes::count> m_lanes;
+	// The count of items in all lanes.
+	std::size_t m_size{0u};
+	weighted_round_robin_t<Lanes> m_round_robin;
+
+	const std::size_t m_capacity;
+
+	bool m_closed{false};
+
+	// NOTE: should be called under the lock.
+	void
+	add(T what)
+	{
+		m_lanes[Lanes::lane(what)].m_items.push_back(std::move(what));
+		++m_size;
+		m_not_empty.notify_one();
+	}
+
+	// Selects the lane for the next extraction.
+	//
+	// NOTE: should be called under the lock for a non-empty queue.
+	std::size_t
+	select_lane() noexcept
+	{
+		return m_round_robin.select([this](std::size_t lane) {
+				return m_lanes[lane].m_items.empty();
+			});
+	}
+
+	// NOTE: should be called under the lock for a non-empty lane.
+	void
+	extract(std::size_t lane, T & receiver)
+	{
+		auto & items = m_lanes[lane].m_items;
+		receiver = std::move(items.front());
+		items.pop_front();
+		--m_size;
+	}
+
+public:
+	explicit lanes_message_queue_t(
+		std::size_t capacity = unlimited_queue_capacity)
+		:	m_capacity{capacity}
+	{
+		if(unlimited_queue_capacity != m_capacity)
+			for(auto & lane : m_lanes)
+				lane.m_items.reserve(m_capacity);
+	}
+
+	void push(T what)
+	{
+		std::lock_guard<std::mutex> lock{m_lock};
+		if(!m_closed)
+			add(std::move(what));
+	}
+
+	// Returns false if the queue is full or closed.
+	// The item is left intact in that case.
+	bool try_push(T & what)
+	{
+		std::lock_guard<std::mutex> lock{m_lock};
+		if(m_closed || m_capacity <= m_size)
+			return false;
+
+		add(std::move(what));
+		return true;
+	}
+
+	// Extracts the oldest item of the last non-empty lane without
+	// waiting. Returns false if the queue is empty or closed.
+	bool try_pop_oldest(T & receiver)
+	{
+		std::lock_guard<std::mutex> lock{m_lock};
+		if(m_closed || !m_size)
+			return false;
+
+		std::size_t lane = m_lanes.size() - 1u;
+		while(m_lanes[lane].m_items.empty())
+			--lane;
+
+		extract(lane, receiver);
+		return true;
+	}
+
+	std::size_t size() const
+	{
+		std::lock_guard<std::mutex> lock{m_lock};
+		return m_size;
+	}
+
+	pop_result_t pop(T & receiver)
+	{
+		std::unique_lock<std::mutex> lock{m_lock};
+		m_not_empty.wait(lock, [&]{ return m_closed || 0u != m_size; });
+		if(m_closed)
+			return pop_result_t::queue_closed;
+
+		extract(select_lane(), receiver);
+		return pop_result_t::extracted;
+	}
+
+	void close() noexcept
+	{
+		std::unique_lock<std::mutex> lock{m_lock};
+		if(!m_closed)
+		{
+			m_closed = true;
+			m_not_empty.notify_all();
+		}
+	}
+};
+
+// Lock-free implementation of bounded multi-producer/multi-consumer
+// message queue.
+//
+// It's based on the bounded MPMC queue by Dmitry Vyukov: every cell of
+// the ring buffer has a sequence number that tells producers and
+// consumers whether the cell is free or contains a value.
+//
+// This queue has the same interface as message_queue_t and can be
+// used instead of it. But because it's bounded push() waits while
+// the queue is full. try_push() uses the same capacity.
+//
+// Both producers and consumers spin for a while if the queue is full
+// (or empty) and then park on a condition variable. The mutex is
+// touched only if someone is parked.
+//
+// T has to be DefaultConstructible and MoveAssignable.
+template<typename T>
+class lock_free_message_queue_t
+{
+	struct cell_t
+	{
+		std::atomic<std::size_t> m_sequence;
+		T m_data;
+	};
+
+	static constexpr std::size_t cache_line_size = 64u;
+
+	// How many times a thread tries to repeat an operation before
+	// yielding and before parking.
+	static constexpr unsigned busy_spins = 64u;
+	static constexpr unsigned yield_spins = 64u;
+
+	const std::size_t m_mask;
+	const std::unique_ptr<cell_t[]> m_buffer;
+
+	// Positions of producers and consumers live in different
+	// cache lines to avoid false sharing.
+	char m_pad0[cache_line_size];
+	std::atomic<std::size_t> m_enqueue_pos{0u};
+	char m_pad1[cache_line_size];
+	std::atomic<std::size_t> m_dequeue_pos{0u};
+	char m_pad2[cache_line_size];
+
+	std::atomic<bool> m_closed{false};
+
+	// Stuff for parking.
+	std::mutex m_park_lock;
+	std::condition_variable m_not_empty;
+	std::condition_variable m_not_full;
+	std::atomic<std::size_t> m_parked_consumers{0u};
+	std::atomic<std::size_t> m_parked_producers{0u};
+
+	static std::size_t
+	round_up_capacity(std::size_t capacity) noexcept
+	{
+		std::size_t result = 2u;
+		while(result < capacity)
+			result <<= 1u;
+		return result;
+	}
+
+	static std::intptr_t
+	distance(std::size_t sequence, std::size_t pos) noexcept
+	{
+		return static_cast<std::intptr_t>(sequence) -
+				static_cast<std::intptr_t>(pos);
+	}
+
+	bool
+	try_enqueue(T & what)
+	{
+		cell_t * cell;
+		auto pos = m_enqueue_pos.load(std::memory_order_relaxed);
+		for(;;)
+		{
+			cell = &m_buffer[pos & m_mask];
+			const auto diff = distance(
+					cell->m_sequence.load(std::memory_order_acquire), pos);
+			if(0 == diff)
+			{
+				if(m_enqueue_pos.compare_exchange_weak(
+						pos, pos + 1u, std::memory_order_relaxed))
+					break;
+			}
+			else if(diff < 0)
+				// The queue is full.
+				return false;
+			else
+				pos = m_enqueue_pos.load(std::memory_order_relaxed);
+		}
+
+		cell->m_data = std::move(what);
+		cell->m_sequence.store(pos + 1u, std::memory_order_release);
+
+		return true;
+	}
+
+	bool
+	try_dequeue(T & receiver)
+	{
+		cell_t * cell;
+		auto pos = m_dequeue_pos.load(std::memory_order_relaxed);
+		for(;;)
+		{
+			cell = &m_buffer[pos & m_mask];
+			const auto diff = distance(
+					cell->m_sequence.load(std::memory_order_acquire), pos + 1u);
+			if(0 == diff)
+			{
+				if(m_dequeue_pos.compare_exchange_weak(
+						pos, pos + 1u, std::memory_order_relaxed))
+					break;
+			}
+			else if(diff < 0)
+				// The queue is empty.
+				return false;
+			else
+				pos = m_dequeue_pos.load(std::memory_order_relaxed);
+		}
+
+		receiver = std::move(cell->m_data);
+		// Resources of the extracted object shouldn't be held by the cell.
+		cell->m_data = T{};
+		cell->m_sequence.store(pos + m_mask + 1u, std::memory_order_release);
+
+		return true;
+	}
+
+	bool
+	has_items() const noexcept
+	{
+		const auto pos = m_dequeue_pos.load(std::memory_order_relaxed);
+		return 0 <= distance(
+				m_buffer[pos & m_mask].m_sequence.load(std::memory_order_acquire),
+				pos + 1u);
+	}
+
+	bool
+	has_free_cells() const noexcept
+	{
+		const auto pos = m_enqueue_pos.load(std::memory_order_relaxed);
+		return 0 <= distance(
+				m_buffer[pos & m_mask].m_sequence.load(std::memory_order_acquire),
+				pos);
+	}
+
+	// Spins, yields or parks the current thread in dependency of
+	// the number of the attempt.
+	template<typename Predicate>
+	void
+	backoff(
+		unsigned attempt,
+		std::condition_variable & cv,
+		std::atomic<std::size_t> & parked_count,
+		Predicate ready)
+	{
+		if(attempt < busy_spins)
+			return;
+
+		if(attempt < busy_spins + yield_spins)
+		{
+			std::this_thread::yield();
+			return;
+		}
+
+		std::unique_lock<std::mutex> lock{m_park_lock};
+		parked_count.fetch_add(1u, std::memory_order_seq_cst);
+		// Pairs with the fence in wake_up().
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		cv.wait(lock, [&]{
+				return m_closed.load(std::memory_order_acquire) || ready();
+			});
+		parked_count.fetch_sub(1u, std::memory_order_relaxed);
+	}
+
+	void
+	wake_up(
+		std::condition_variable & cv,
+		std::atomic<std::size_t> & parked_count)
+	{
+		// Pairs with the fence in backoff(). Either the parking thread
+		// sees the result of the last operation or we see it as parked.
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(parked_count.load(std::memory_order_relaxed))
+		{
+			// The lock guarantees that the parking thread is already
+			// waiting on the condition variable.
+			std::lock_guard<std::mutex> lock{m_park_lock};
+			cv.notify_one();
+		}
+	}
+
+public:
+	// NOTE: capacity is rounded up to the nearest power of two.
+	explicit lock_free_message_queue_t(std::size_t capacity = 4096u)
+		:	m_mask{round_up_capacity(capacity) - 1u}
+		,	m_buffer{new cell_t[m_mask + 1u]}
+	{
+		for(std::size_t i = 0u; i != m_mask + 1u; ++i)
+			m_buffer[i].m_sequence.store(i, std::memory_order_relaxed);
+	}
+
+	lock_free_message_queue_t(const lock_free_message_queue_t &) = delete;
+	lock_free_message_queue_t(lock_free_message_queue_t &&) = delete;
+
+	void push(T what)
+	{
+		for(unsigned attempt = 0u;; ++attempt)
+		{
+			if(m_closed.load(std::memory_order_acquire))
+				return;
+
+			if(try_enqueue(what))
+			{
+				wake_up(m_not_empty, m_parked_consumers);
+				return;
+			}
+
+			backoff(attempt, m_not_full, m_parked_producers,
+					[this]{ return has_free_cells(); });
+		}
+	}
+
+	pop_result_t pop(T & receiver)
+	{
+		for(unsigned attempt = 0u;; ++attempt)
+		{
+			if(m_closed.load(std::memory_order_acquire))
+				break;
+
+			if(try_dequeue(receiver))
+			{
+				wake_up(m_not_full, m_parked_producers);
+				return pop_result_t::extracted;
+			}
+
+			backoff(attempt, m_not_empty, m_parked_consumers,
+					[this]{ return has_items(); });
+		}
+
+		return pop_result_t::queue_closed;
+	}
+
+	// Returns false if the queue is full or closed.
+	// The item is left intact in that case.
+	bool try_push(T & what)
+	{
+		if(m_closed.load(std::memory_order_acquire) || !try_enqueue(what))
+			return false;
+
+		wake_up(m_not_empty, m_parked_consumers);
+		return true;
+	}
+
+	// Extracts the oldest item without waiting.
+	// Returns false if the queue is empty or closed.
+	bool try_pop_oldest(T & receiver)
+	{
+		if(m_closed.load(std::memory_order_acquire) || !try_dequeue(receiver))
+			return false;
+
+		wake_up(m_not_full, m_parked_producers);
+		return true;
+	}
+
+	// NOTE: the value is approximate if the queue is used
+	// concurrently.
+	std::size_t size() const noexcept
+	{
+		const auto dequeued = m_dequeue_pos.load(std::memory_order_relaxed);
+		const auto enqueued = m_enqueue_pos.load(std::memory_order_relaxed);
+		return dequeued < enqueued ? enqueued - dequeued : 0u;
+	}
+
+	void close() noexcept
+	{
+		std::lock_guard<std::mutex> lock{m_park_lock};
+		if(!m_closed.exchange(true, std::memory_order_acq_rel))
+		{
+			m_not_empty.notify_all();
+			m_not_full.notify_all();
+		}
+	}
+};
+
+// Task queue with work stealing.
+//
+// Every worker thread has its own deque of tasks. A task pushed by
+// a worker goes to the back of its own deque and the worker takes
+// tasks from the back too. So the most recently pushed task, which
+// data is still in the cache, is processed first. Tasks pushed by
+// other threads (e.g. by the IO thread) are distributed over deques
+// of workers round-robin. They go to the front of a deque, so the
+// owner takes them in FIFO order after its own tasks. A worker
+// without tasks steals from the front of the deque of a random victim.
+//
+// Tasks pushed before any worker has started go to the shared
+// injection queue.
+//
+// Every deque is protected by its own mutex, so the owner contends
+// only with thieves.
+//
+// This queue has the same interface as message_queue_t and can be
+// used instead of it. A thread becomes a worker on the first call to
+// pop(). A thread can be a worker of several queues.
+//
+// The capacity is checked by try_push() against the count of pending
+// tasks, so it can be exceeded a bit by concurrent producers.
+// try_pop_oldest() takes the oldest task of the injection queue or
+// of the first non-empty deque.
+template<typename T>
+class work_stealing_queue_t
+{
+	struct worker_deque_t
+	{
+		std::mutex m_lock;
+		std::deque<T> m_tasks;
+	};
+
+	// Info about the current thread as a worker of a queue.
+	//
+	// NOTE: queues are identified by m_id, not by the address. A new
+	// queue can be created at the address of a destroyed one.
+	struct thread_info_t
+	{
+		std::uint64_t m_queue_id{0u};
+		std::size_t m_index{not_a_worker};
+		// The state of the generator of random victims.
+		std::uint32_t m_random{0u};
+	};
+
+	static constexpr std::size_t not_a_worker = static_cast<std::size_t>(-1);
+
+	// How many times a thread tries to get a task before yielding
+	// and before parking.
+	static constexpr unsigned busy_spins = 64u;
+	static constexpr unsigned yield_spins = 64u;
+
+	const std::size_t m_capacity;
+
+	// The unique ID of the queue, never 0.
+	const std::uint64_t m_id;
+
+	const std::size_t m_max_workers;
+	const std::unique_ptr<worker_deque_t[]> m_workers;
+	std::atomic<std::size_t> m_workers_count{0u};
+
+	// The deque for the next task pushed by a non-worker thread.
+	std::atomic<std::size_t> m_next_deque{0u};
+
+	std::mutex m_injection_lock;
+	std::queue<T> m_injection;
+
+	// The count of tasks in all deques and in the injection queue.
+	// It's modified under the lock of the container the task is
+	// added to or removed from, so it never underflows.
+	std::atomic<std::size_t> m_pending{0u};
+
+	std::atomic<bool> m_closed{false};
+
+	// Stuff for parking.
+	std::mutex m_park_lock;
+	std::condition_variable m_not_empty;
+	std::atomic<std::size_t> m_parked{0u};
+
+	static std::uint64_t
+	make_queue_id() noexcept
+	{
+		static std::atomic<std::uint64_t> last_id{0u};
+		return last_id.fetch_add(1u, std::memory_order_relaxed) + 1u;
+	}
+
+	// Infos of the current thread for every queue it works for.
+	// Usually it's only one queue.
+	static std::vector<thread_info_t> &
+	current_thread_infos() noexcept
+	{
+		static thread_local std::vector<thread_info_t> infos;
+		return infos;
+	}
+
+	// Returns nullptr if the current thread isn't a worker of this queue.
+	thread_info_t *
+	find_current_thread_info() const noexcept
+	{
+		for(auto & info : current_thread_infos())
+			if(m_id == info.m_queue_id)
+				return &info;
+		return nullptr;
+	}
+
+	std::size_t
+	current_worker_index() const noexcept
+	{
+		const auto * info = find_current_thread_info();
+		return info ? info->m_index : not_a_worker;
+	}
+
+	thread_info_t &
+	register_current_thread()
+	{
+		if(auto * info = find_current_thread_info())
+			return *info;
+
+		const auto index = m_workers_count.fetch_add(
+				1u, std::memory_order_relaxed);
+		thread_info_t info;
+		info.m_queue_id = m_id;
+		// Extra threads work only with the injection queue and
+		// steal from others.
+		info.m_index = index < m_max_workers ? index : not_a_worker;
+		info.m_random = static_cast<std::uint32_t>(index) * 2654435761u + 1u;
+
+		auto & infos = current_thread_infos();
+		infos.push_back(info);
+		return infos.back();
+	}
+
+	static std::uint32_t
+	next_random(std::uint32_t & state) noexcept
+	{
+		// xorshift32.
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+
+	template<typename Container, typename Taker>
+	bool
+	try_take_from(
+		std::mutex & lock,
+		Container & tasks,
+		T & receiver,
+		Taker take)
+	{
+		std::lock_guard<std::mutex> guard{lock};
+		if(tasks.empty())
+			return false;
+
+		take(tasks, receiver);
+		m_pending.fetch_sub(1u, std::memory_order_relaxed);
+		return true;
+	}
+
+	static void
+	take_back(std::deque<T> & tasks, T & to)
+	{
+		to = std::move(tasks.back());
+		tasks.pop_back();
+	}
+
+	static void
+	take_front(std::deque<T> & tasks, T & to)
+	{
+		to = std::move(tasks.front());
+		tasks.pop_front();
+	}
+
+	static void
+	take_injected(std::queue<T> & tasks, T & to)
+	{
+		to = std::move(tasks.front());
+		tasks.pop();
+	}
+
+	std::size_t
+	active_workers_count() const noexcept
+	{
+		return std::min(
+				m_workers_count.load(std::memory_order_relaxed), m_max_workers);
+	}
+
+	bool
+	try_take(thread_info_t & info, T & receiver)
+	{
+		if(not_a_worker != info.m_index)
+		{
+			auto & own = m_workers[info.m_index];
+			if(try_take_from(own.m_lock, own.m_tasks, receiver, take_back))
+				return true;
+		}
+
+		if(try_take_from(m_injection_lock, m_injection, receiver, take_injected))
+			return true;
+
+		const auto count = active_workers_count();
+		if(!count)
+			return false;
+
+		const auto first = next_random(info.m_random) % count;
+		for(std::size_t i = 0u; i != count; ++i)
+		{
+			const auto victim = (first + i) % count;
+			if(victim == info.m_index)
+				continue;
+
+			auto & other = m_workers[victim];
+			if(try_take_from(other.m_lock, other.m_tasks, receiver, take_front))
+				return true;
+		}
+
+		return false;
+	}
+
+	void
+	backoff(unsigned attempt)
+	{
+		if(attempt < busy_spins)
+			return;
+
+		if(attempt < busy_spins + yield_spins)
+		{
+			std::this_thread::yield();
+			return;
+		}
+
+		std::unique_lock<std::mutex> lock{m_park_lock};
+		m_parked.fetch_add(1u, std::memory_order_seq_cst);
+		// Pairs with the fence in push().
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		m_not_empty.wait(lock, [this]{
+				return m_closed.load(std::memory_order_acquire) ||
+						0u != m_pending.load(std::memory_order_acquire);
+			});
+		m_parked.fetch_sub(1u, std::memory_order_relaxed);
+	}
+
+public:
+	explicit work_stealing_queue_t(
+		std::size_t capacity = unlimited_queue_capacity,
+		std::size_t max_workers = 64u)
+		:	m_capacity{capacity}
+		,	m_id{make_queue_id()}
+		,	m_max_workers{max_workers}
+		,	m_workers{new worker_deque_t[max_workers]}
+	{}
+
+	work_stealing_queue_t(const work_stealing_queue_t &) = delete;
+	work_stealing_queue_t(work_stealing_queue_t &&) = delete;
+
+	void push(T what)
+	{
+		if(m_closed.load(std::memory_order_acquire))
+			return;
+
+		// The counter is incremented before the task becomes visible
+		// to consumers.
+		const auto index = current_worker_index();
+		const auto workers_count = active_workers_count();
+		if(not_a_worker != index)
+		{
+			auto & own = m_workers[index];
+			std::lock_guard<std::mutex> lock{own.m_lock};
+			m_pending.fetch_add(1u, std::memory_order_release);
+			own.m_tasks.push_back(std::move(what));
+		}
+		else if(workers_count)
+		{
+			auto & target = m_workers[
+					m_next_deque.fetch_add(1u, std::memory_order_relaxed) %
+					workers_count];
+			std::lock_guard<std::mutex> lock{target.m_lock};
+			m_pending.fetch_add(1u, std::memory_order_release);
+			target.m_tasks.push_front(std::move(what));
+		}
+		else
+		{
+			std::lock_guard<std::mutex> lock{m_injection_lock};
+			m_pending.fetch_add(1u, std::memory_order_release);
+			m_injection.push(std::move(what));
+		}
+
+		// Pairs with the fence in backoff(). Either the parking thread
+		// sees the new task or we see it as parked.
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(m_parked.load(std::memory_order_relaxed))
+		{
+			std::lock_guard<std::mutex> lock{m_park_lock};
+			m_not_empty.notify_one();
+		}
+	}
+
+	pop_result_t pop(T & receiver)
+	{
+		auto & info = register_current_thread();
+		for(unsigned attempt = 0u;; ++attempt)
+		{
+			if(m_closed.load(std::memory_order_acquire))
+				break;
+
+			if(try_take(info, receiver))
+				return pop_result_t::extracted;
+
+			backoff(attempt);
+		}
+
+		return pop_result_t::queue_closed;
+	}
+
+	// Returns false if the queue is full or closed.
+	// The item is left intact in that case.
+	bool try_push(T & what)
+	{
+		if(m_closed.load(std::memory_order_acquire) ||
+				m_capacity <= m_pending.load(std::memory_order_relaxed))
+			return false;
+
+		push(std::move(what));
+		return true;
+	}
+
+	// Extracts the oldest task of the injection queue or of the first
+	// non-empty deque without waiting. Tasks from other threads are at
+	// the front of a deque, so the oldest of them is at the back.
+	// Returns false if there are no tasks or the queue is closed.
+	bool try_pop_oldest(T & receiver)
+	{
+		if(m_closed.load(std::memory_order_acquire))
+			return false;
+
+		if(try_take_from(m_injection_lock, m_injection, receiver, take_injected))
+			return true;
+
+		const auto count = active_workers_count();
+		for(std::size_t i = 0u; i != count; ++i)
+		{
+			auto & deque = m_workers[i];
+			if(try_take_from(deque.m_lock, deque.m_tasks, receiver, take_back))
+				return true;
+		}
+
+		return false;
+	}
+
+	std::size_t size() const noexcept
+	{
+		return m_pending.load(std::memory_order_relaxed);
+	}
+
+	void close() noexcept
+	{
+		std::lock_guard<std::mutex> lock{m_park_lock};
+		if(!m_closed.exchange(true, std::memory_order_acq_rel))
+			m_not_empty.notify_all();
+	}
+};
+
+// Limits the count of activities of some kind (like requests that
+// hold a worker thread for a long time) performed at the same time.
+class concurrency_limit_t
+{
+	const std::size_t m_max_active;
+	std::atomic<std::size_t> m_active{0u};
+
+public:
+	explicit concurrency_limit_t(std::size_t max_active)
+		:	m_max_active{max_active}
+	{}
+
+	concurrency_limit_t(const concurrency_limit_t &) = delete;
+	concurrency_limit_t & operator=(const concurrency_limit_t &) = delete;
+
+	// Returns false if there are already max_active activities.
+	// release() should be called for every successful call.
+	bool
+	try_acquire() noexcept
+	{
+		auto active = m_active.load(std::memory_order_relaxed);
+		do
+		{
+			if(m_max_active <= active)
+				return false;
+		}
+		while(!m_active.compare_exchange_weak(
+				active, active + 1u, std::memory_order_acquire));
+
+		return true;
+	}
+
+	void
+	release() noexcept
+	{
+		m_active.fetch_sub(1u, std::memory_order_release);
+	}
+};
+
+// Releases an acquired slot of concurrency_limit_t at the end
+// of the scope.
+class concurrency_slot_t
+{
+	concurrency_limit_t & m_limit;
+
+public:
+	explicit concurrency_slot_t(concurrency_limit_t & limit) noexcept
+		:	m_limit{limit}
+	{}
+
+	concurrency_slot_t(const concurrency_slot_t &) = delete;
+	concurrency_slot_t & operator=(const concurrency_slot_t &) = delete;
+
+	~concurrency_slot_t() noexcept
+	{
+		m_limit.release();
+	}
+};
+
 } /* namespace crud_example */
 
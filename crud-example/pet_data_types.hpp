@@ -2,7 +2,12 @@
 
 #include <json_dto/pub.hpp>
 
+#include "arena.hpp"
+
+#include <cstdint>
+#include <functional>
 #include <string>
+#include <vector>
 
 namespace crud_example
 {
@@ -97,7 +102,64 @@ struct bunch_of_pet_ids_t
 	}
 };
 
+// A reference to a string that is stored somewhere else.
+struct string_ref_t
+{
+	const char * m_data;
+	std::size_t m_size;
+};
+
+// A pet which strings are stored somewhere else: in the current row
+// of a DB statement or in an arena.
+//
+// It's used for serialization of pets without allocation of
+// memory for every string.
+struct pet_view_t
+{
+	pet_id_t m_id;
+	string_ref_t m_name;
+	string_ref_t m_type;
+	string_ref_t m_owner;
+	string_ref_t m_picture;
+};
+
+// A list of pets which strings are stored in an arena.
+using arena_pets_t = std::vector<pet_view_t, arena_allocator_t<pet_view_t>>;
+
+// Description of a line that can't be imported by the bulk import.
+struct bulk_import_error_t
+{
+	// Lines are numbered from 1.
+	std::uint64_t m_line;
+	std::string m_description;
+
+	template<typename Json_Io>
+	void json_io(Json_Io & io)
+	{
+		io & json_dto::mandatory("line", m_line)
+			& json_dto::mandatory("description", m_description);
+	}
+};
+
+struct bulk_import_result_t
+{
+	std::vector<pet_id_t> m_ids;
+	std::vector<bulk_import_error_t> m_errors;
+
+	template<typename Json_Io>
+	void json_io(Json_Io & io)
+	{
+		io & json_dto::mandatory("ids", m_ids)
+			& json_dto::mandatory("errors", m_errors);
+	}
+};
+
 } /* namespace model */
 
+// Type of function that receives pets by chunks.
+// The consumer can take pets from the chunk.
+using pets_chunk_consumer_t = std::function<
+		void(std::vector<model::pet_without_id_t> &)>;
+
 } /* namespace crud_example */
 
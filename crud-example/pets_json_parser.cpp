@@ -0,0 +1,557 @@
+#include "pets_json_parser.hpp"
+
+#include <rapidjson/reader.h>
+#include <rapidjson/memorystream.h>
+#include <rapidjson/error/en.h>
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <string>
+
+namespace crud_example
+{
+
+namespace
+{
+
+// Handler of SAX-events for parse_bunch_of_pets() and
+// check_bunch_of_pets().
+//
+// If there is no consumer pets are only checked: values of fields
+// aren't copied and pets aren't collected into chunks.
+class bunch_of_pets_handler_t
+	:	public rapidjson::BaseReaderHandler<
+			rapidjson::UTF8<>, bunch_of_pets_handler_t >
+{
+	enum class state_t
+	{
+		expect_root_object,
+		in_root_object,
+		expect_pets_array,
+		in_pets_array,
+		in_pet,
+		expect_pet_field,
+		// A value of an unknown field is skipped.
+		skip_value,
+		finished
+	};
+
+	// Flags of the fields of a pet.
+	static constexpr unsigned name_field = 1u;
+	static constexpr unsigned type_field = 2u;
+	static constexpr unsigned owner_field = 4u;
+	static constexpr unsigned picture_field = 8u;
+	static constexpr unsigned all_fields =
+			name_field | type_field | owner_field | picture_field;
+
+	const std::size_t m_chunk_size;
+	// It's nullptr if pets are only checked.
+	const pets_chunk_consumer_t * const m_consumer;
+
+	state_t m_state{state_t::expect_root_object};
+
+	// The state to return to after the skipped value.
+	state_t m_state_after_skip{state_t::in_root_object};
+	// The nesting level of the skipped value.
+	std::size_t m_skip_depth{0u};
+
+	bool m_pets_found{false};
+	std::size_t m_pets_count{0u};
+
+	std::vector<model::pet_without_id_t> m_chunk;
+
+	// The pet being parsed and its already found fields.
+	model::pet_without_id_t m_pet;
+	unsigned m_pet_fields{0u};
+
+	// The field for the next string value.
+	std::string * m_field{nullptr};
+
+	std::string m_error;
+	std::exception_ptr m_consumer_exception;
+
+	bool
+	fail(std::string error)
+	{
+		m_error = std::move(error);
+		return false;
+	}
+
+	void
+	start_skip(state_t return_to) noexcept
+	{
+		m_state_after_skip = return_to;
+		m_skip_depth = 0u;
+		m_state = state_t::skip_value;
+	}
+
+	bool
+	on_pet_field(const Ch * name, rapidjson::SizeType length)
+	{
+		const auto is = [name, length](const char * expected) {
+			return std::strlen(expected) == length &&
+					0 == std::memcmp(expected, name, length);
+		};
+
+		const auto expect_field = [this](unsigned flag, std::string & field) {
+			m_pet_fields |= flag;
+			m_field = &field;
+			m_state = state_t::expect_pet_field;
+		};
+
+		if(is("name"))
+			expect_field(name_field, m_pet.m_data.m_name);
+		else if(is("type"))
+			expect_field(type_field, m_pet.m_data.m_type);
+		else if(is("owner"))
+			expect_field(owner_field, m_pet.m_data.m_owner);
+		else if(is("picture"))
+			expect_field(picture_field, m_pet.m_data.m_picture);
+		else
+			start_skip(state_t::in_pet);
+
+		return true;
+	}
+
+	bool
+	on_pet_completed()
+	{
+		++m_pets_count;
+		if(all_fields != m_pet_fields)
+			return fail(fmt::format(
+					"pet #{} doesn't have all mandatory fields",
+					m_pets_count));
+
+		if(!m_consumer)
+			return true;
+
+		m_chunk.push_back(std::move(m_pet));
+		if(m_chunk_size <= m_chunk.size())
+			return pass_chunk();
+
+		return true;
+	}
+
+	bool
+	pass_chunk()
+	{
+		try
+		{
+			(*m_consumer)(m_chunk);
+			// The consumer could take the content of the chunk.
+			m_chunk.clear();
+			m_chunk.reserve(m_chunk_size);
+			return true;
+		}
+		catch(...)
+		{
+			m_consumer_exception = std::current_exception();
+			return false;
+		}
+	}
+
+	// Handling of the end of a skipped value.
+	bool
+	on_skipped_value_end() noexcept
+	{
+		if(0u == m_skip_depth)
+			m_state = m_state_after_skip;
+		return true;
+	}
+
+public:
+	bunch_of_pets_handler_t(
+		std::size_t chunk_size,
+		const pets_chunk_consumer_t * consumer)
+		:	m_chunk_size{chunk_size}
+		,	m_consumer{consumer}
+	{
+		if(m_consumer)
+			m_chunk.reserve(chunk_size);
+	}
+
+	// All scalar values except strings.
+	bool
+	Default()
+	{
+		if(state_t::skip_value == m_state)
+			return on_skipped_value_end();
+
+		if(state_t::expect_pet_field == m_state)
+			return fail("a field of a pet should be a string");
+
+		return fail("unexpected value");
+	}
+
+	bool
+	String(const Ch * str, rapidjson::SizeType length, bool)
+	{
+		if(state_t::expect_pet_field == m_state)
+		{
+			if(m_consumer)
+				m_field->assign(str, length);
+			m_state = state_t::in_pet;
+			return true;
+		}
+
+		return Default();
+	}
+
+	bool
+	Key(const Ch * str, rapidjson::SizeType length, bool)
+	{
+		switch(m_state)
+		{
+		case state_t::in_root_object:
+			if(4u == length && 0 == std::memcmp("pets", str, length))
+			{
+				if(m_pets_found)
+					return fail("duplicate 'pets' field");
+				m_state = state_t::expect_pets_array;
+			}
+			else
+				start_skip(state_t::in_root_object);
+		return true;
+
+		case state_t::in_pet:
+		return on_pet_field(str, length);
+
+		default:
+		return true;
+		}
+	}
+
+	bool
+	StartObject()
+	{
+		switch(m_state)
+		{
+		case state_t::expect_root_object:
+			m_state = state_t::in_root_object;
+		return true;
+
+		case state_t::in_pets_array:
+			if(m_consumer)
+				m_pet = model::pet_without_id_t{};
+			m_pet_fields = 0u;
+			m_state = state_t::in_pet;
+		return true;
+
+		case state_t::skip_value:
+			++m_skip_depth;
+		return true;
+
+		case state_t::expect_pet_field:
+		return fail("a field of a pet should be a string");
+
+		default:
+		return fail("unexpected object");
+		}
+	}
+
+	bool
+	EndObject(rapidjson::SizeType)
+	{
+		switch(m_state)
+		{
+		case state_t::in_root_object:
+			if(!m_pets_found)
+				return fail("'pets' field not found");
+			m_state = state_t::finished;
+		return m_chunk.empty() || pass_chunk();
+
+		case state_t::in_pet:
+			m_state = state_t::in_pets_array;
+		return on_pet_completed();
+
+		case state_t::skip_value:
+			--m_skip_depth;
+		return on_skipped_value_end();
+
+		default:
+		return fail("unexpected end of object");
+		}
+	}
+
+	bool
+	StartArray()
+	{
+		switch(m_state)
+		{
+		case state_t::expect_pets_array:
+			m_pets_found = true;
+			m_state = state_t::in_pets_array;
+		return true;
+
+		case state_t::skip_value:
+			++m_skip_depth;
+		return true;
+
+		case state_t::expect_pet_field:
+		return fail("a field of a pet should be a string");
+
+		default:
+		return fail("unexpected array");
+		}
+	}
+
+	bool
+	EndArray(rapidjson::SizeType)
+	{
+		switch(m_state)
+		{
+		case state_t::in_pets_array:
+			m_state = state_t::in_root_object;
+		return true;
+
+		case state_t::skip_value:
+			--m_skip_depth;
+		return on_skipped_value_end();
+
+		default:
+		return fail("unexpected end of array");
+		}
+	}
+
+	const std::string &
+	error() const noexcept
+	{
+		return m_error;
+	}
+
+	const std::exception_ptr &
+	consumer_exception() const noexcept
+	{
+		return m_consumer_exception;
+	}
+};
+
+bool
+is_json_whitespace(char ch) noexcept
+{
+	return ' ' == ch || '\t' == ch || '\n' == ch || '\r' == ch;
+}
+
+const char *
+skip_whitespaces(const char * p, const char * end) noexcept
+{
+	while(p != end && is_json_whitespace(*p))
+		++p;
+	return p;
+}
+
+// Returns a pointer to the closing quote of a string.
+// p should point to the opening quote.
+const char *
+skip_string(const char * p, const char * end)
+{
+	for(++p; p != end; ++p)
+	{
+		if('\\' == *p)
+		{
+			if(++p == end)
+				break;
+		}
+		else if('"' == *p)
+			return p;
+	}
+
+	throw json_dto::ex_t{"unexpected end of document inside a string"};
+}
+
+// Returns a pointer to the first character of "pets" array
+// (right after the opening bracket).
+const char *
+find_pets_array(const char * p, const char * end)
+{
+	std::size_t depth = 0u;
+	for(; p != end; ++p)
+	{
+		switch(*p)
+		{
+		case '"':
+		{
+			const char * key = p + 1;
+			p = skip_string(p, end);
+			if(1u != depth)
+				break;
+
+			// A string is a key only if it's followed by a colon.
+			const char * next = skip_whitespaces(p + 1, end);
+			if(next == end || ':' != *next)
+				break;
+
+			if(4 == p - key && 0 == std::memcmp("pets", key, 4u))
+			{
+				next = skip_whitespaces(next + 1, end);
+				if(next == end || '[' != *next)
+					throw json_dto::ex_t{"'pets' field should be an array"};
+				return next + 1;
+			}
+		}
+		break;
+
+		case '{': case '[':
+			++depth;
+		break;
+
+		case '}': case ']':
+			if(0u == depth)
+				throw json_dto::ex_t{"unexpected end of object"};
+			--depth;
+		break;
+		}
+	}
+
+	throw json_dto::ex_t{"'pets' field not found"};
+}
+
+// Checks the document outside of "pets" array by the same rules
+// as parse_bunch_of_pets() does. The content of the array (from
+// array_begin to array_end that points to the closing bracket) is
+// removed from the document for that.
+void
+check_document_without_pets(
+	const char * data,
+	const char * array_begin,
+	const char * array_end,
+	const char * end)
+{
+	std::string document;
+	document.reserve(static_cast<std::size_t>(
+			(array_begin - data) + (end - array_end)));
+	document.append(data, array_begin);
+	document.append(array_end, end);
+
+	check_bunch_of_pets(document.data(), document.size());
+}
+
+void
+run_bunch_of_pets_handler(
+	const char * data,
+	std::size_t size,
+	bunch_of_pets_handler_t & handler)
+{
+	rapidjson::MemoryStream stream{data, size};
+	rapidjson::Reader reader;
+
+	const auto result = reader.Parse(stream, handler);
+	if(!result)
+	{
+		if(handler.consumer_exception())
+			std::rethrow_exception(handler.consumer_exception());
+
+		if(!handler.error().empty())
+			throw json_dto::ex_t{fmt::format(
+					"{} (offset {})", handler.error(), result.Offset())};
+
+		throw json_dto::ex_t{fmt::format("{} (offset {})",
+				rapidjson::GetParseError_En(result.Code()),
+				result.Offset())};
+	}
+}
+
+} /* namespace anonymous */
+
+void
+parse_bunch_of_pets(
+	const char * data,
+	std::size_t size,
+	std::size_t chunk_size,
+	const pets_chunk_consumer_t & consumer)
+{
+	bunch_of_pets_handler_t handler{chunk_size, &consumer};
+	run_bunch_of_pets_handler(data, size, handler);
+}
+
+void
+check_bunch_of_pets(
+	const char * data,
+	std::size_t size)
+{
+	bunch_of_pets_handler_t handler{0u, nullptr};
+	run_bunch_of_pets_handler(data, size, handler);
+}
+
+std::vector<json_fragment_t>
+split_pets_array(
+	const char * data,
+	std::size_t size,
+	std::size_t parts_count)
+{
+	const char * const end = data + size;
+	const char * p = find_pets_array(data, end);
+	const char * const array_begin = p;
+
+	// A fragment is completed at the first comma after this size.
+	const std::size_t fragment_size = std::max<std::size_t>(
+			1u, static_cast<std::size_t>(end - p) / std::max<std::size_t>(1u, parts_count));
+
+	std::vector<json_fragment_t> result;
+	const char * fragment_begin = p;
+	const auto add_fragment = [&](const char * fragment_end) {
+			result.push_back(json_fragment_t{
+					fragment_begin,
+					static_cast<std::size_t>(fragment_end - fragment_begin)});
+			fragment_begin = fragment_end + 1;
+		};
+
+	std::size_t depth = 0u;
+	for(; p != end; ++p)
+	{
+		switch(*p)
+		{
+		case '"':
+			p = skip_string(p, end);
+		break;
+
+		case '{': case '[':
+			++depth;
+		break;
+
+		case '}': case ']':
+			if(0u == depth)
+			{
+				// The end of "pets" array.
+				if(skip_whitespaces(fragment_begin, p) != p)
+					add_fragment(p);
+				else if(!result.empty())
+					throw json_dto::ex_t{"unexpected comma at the end of 'pets' array"};
+
+				// The rest of the document should be valid too,
+				// as if it's parsed by parse_bunch_of_pets().
+				check_document_without_pets(data, array_begin, p, end);
+				return result;
+			}
+			--depth;
+		break;
+
+		case ',':
+			if(0u == depth &&
+					fragment_size <= static_cast<std::size_t>(p - fragment_begin))
+				add_fragment(p);
+		break;
+		}
+	}
+
+	throw json_dto::ex_t{"unexpected end of 'pets' array"};
+}
+
+std::vector<model::pet_without_id_t>
+parse_pets_fragment(const json_fragment_t & fragment)
+{
+	// The fragment is turned into a complete document.
+	std::string document;
+	document.reserve(fragment.m_size + 16u);
+	document += R"({"pets":[)";
+	document.append(fragment.m_data, fragment.m_size);
+	document += "]}";
+
+	return json_dto::from_json<model::bunch_of_pets_without_id_t>(document).m_pets;
+}
+
+} /* namespace crud_example */
+
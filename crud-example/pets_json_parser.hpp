@@ -0,0 +1,68 @@
+#pragma once
+
+#include "pet_data_types.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace crud_example
+{
+
+// Parses a document like {"pets":[{...}, ...]} without building DOM
+// and the whole list of pets.
+//
+// Pets are passed to the consumer by chunks of no more than chunk_size
+// items, so memory consumption doesn't depend on the size of the document.
+// A chunk is passed to the consumer as soon as it is filled.
+//
+// Throws json_dto::ex_t if the document has invalid format. Pets from
+// the beginning of the document could be passed to the consumer already.
+void
+parse_bunch_of_pets(
+	const char * data,
+	std::size_t size,
+	std::size_t chunk_size,
+	const pets_chunk_consumer_t & consumer);
+
+// Checks a document like {"pets":[{...}, ...]} by the same rules as
+// parse_bunch_of_pets() but doesn't build pets. It's much cheaper than
+// parsing with a consumer that ignores pets.
+//
+// Throws json_dto::ex_t if the document has invalid format.
+void
+check_bunch_of_pets(
+	const char * data,
+	std::size_t size);
+
+// A part of a JSON document.
+struct json_fragment_t
+{
+	const char * m_data;
+	std::size_t m_size;
+};
+
+// Splits the content of "pets" array of a document like {"pets":[...]}
+// into no more than parts_count fragments of similar size.
+// Every fragment contains whole elements of the array separated
+// by commas. Fragments go in the order of the document.
+//
+// Only boundaries of elements are looked for here, the elements
+// themselves are checked by parse_pets_fragment(). The rest of
+// the document is checked here the same way as by parse_bunch_of_pets().
+//
+// Throws json_dto::ex_t if "pets" array isn't found or the document
+// outside of the array is invalid.
+std::vector<json_fragment_t>
+split_pets_array(
+	const char * data,
+	std::size_t size,
+	std::size_t parts_count);
+
+// Parses a fragment made by split_pets_array().
+//
+// Throws json_dto::ex_t if the fragment has invalid format.
+std::vector<model::pet_without_id_t>
+parse_pets_fragment(const json_fragment_t & fragment);
+
+} /* namespace crud_example */
+
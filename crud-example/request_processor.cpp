@@ -1,11 +1,23 @@
 #include "request_processor.hpp"
+#include "pets_json_parser.hpp"
+#include "multithreading.hpp"
+#include "json_body.hpp"
 
 #include <restinio/helpers/http_field_parsers/content-type.hpp>
 #include <restinio/helpers/file_upload.hpp>
 
 #include <fmt/format.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <future>
+#include <iterator>
+#include <mutex>
 #include <stdexcept>
+#include <vector>
 
 namespace crud_example
 {
@@ -18,9 +30,13 @@ const int json_dto_error = 1;
 const int sqlite_error = 2;
 const int invalid_pet_id = 3;
 const int invalid_request = 4;
+const int server_overloaded = 5;
 
 } /* namespace errors */
 
+// The value of Retry-After header of 503 responses.
+const std::chrono::seconds overload_retry_after{1};
+
 // Type of object to be returned in a HTTP-response for a failed request.
 struct failure_description_t
 {
@@ -69,41 +85,222 @@ public:
 namespace
 {
 
-// Helper function for wrapping request processing routine and making
-// the response in dependency of processing result.
-template<typename F>
-void
-wrap_request_processing(
-	const restinio::request_handle_t & req,
-	F && functor)
+// A request together with the route it was accepted by.
+// It's necessary for collecting metrics about the response.
+struct request_context_t
+{
+	restinio::request_handle_t m_req;
+	metrics_registry_t & m_metrics;
+	route_id_t m_route;
+};
+
+// Helper function for making the description of the current exception.
+// Must be called from a catch block.
+//
+// Returns the status for the response, the response body is stored
+// into response_body.
+restinio::http_status_line_t
+describe_current_exception(std::string & response_body)
 {
-	std::string response_body;
-	auto response_status = restinio::status_ok();
 	try
 	{
-		response_body = json_dto::to_json(functor());
+		throw;
 	}
 	catch(const request_processing_failure_t & x)
 	{
-		response_status = x.response_status();
 		response_body = json_dto::to_json(x.failure_description());
+		return x.response_status();
 	}
 	catch(...)
 	{
-		response_status = restinio::status_internal_server_error();
 		response_body = json_dto::to_json(
 				failure_description_t{
 						errors::unknow_error,
 						"unexpected application failure"});
+		return restinio::status_internal_server_error();
 	}
+}
 
-	req->create_response(response_status)
-		.append_header_date_field()
+void
+send_json_response(
+	const request_context_t & ctx,
+	restinio::http_status_line_t response_status,
+	restinio::writable_item_t response_body)
+{
+	ctx.m_metrics.on_response(ctx.m_route,
+			response_status.status_code().raw_code());
+
+	auto response = ctx.m_req->create_response(response_status);
+	response.append_header_date_field();
+
+	// The server is overloaded, the request can be retried later.
+	if(restinio::status_service_unavailable().status_code().raw_code() ==
+			response_status.status_code().raw_code())
+		response.append_header(restinio::http_field::retry_after,
+				std::to_string(overload_retry_after.count()));
+
+	response
 		.append_header(restinio::http_field::content_type, "application/json")
-		.set_body(response_body)
+		.set_body(std::move(response_body))
 		.done();
 }
 
+void
+send_failure_response(
+	const request_context_t & ctx,
+	const request_processing_failure_t & failure)
+{
+	send_json_response(ctx,
+			failure.response_status(),
+			json_dto::to_json(failure.failure_description()));
+}
+
+// Helper function for wrapping request processing routine and making
+// the response in dependency of processing result.
+template<typename F>
+void
+wrap_request_processing(
+	const request_context_t & ctx,
+	F && functor)
+{
+	std::shared_ptr<const json_body_t> response_body;
+	try
+	{
+		auto result = functor();
+
+		stage_timer_t serialization_timer{
+				ctx.m_metrics, ctx.m_route, stage_t::serialization};
+		response_body = pooled_json_serializer_t::for_current_thread()
+				.serialize(result);
+	}
+	catch(...)
+	{
+		std::string failure_body;
+		auto response_status = describe_current_exception(failure_body);
+		send_json_response(ctx, std::move(response_status), std::move(failure_body));
+		return;
+	}
+
+	send_json_response(ctx, restinio::status_ok(), std::move(response_body));
+}
+
+// The same as wrap_request_processing() but functor returns
+// already serialized body of the response.
+template<typename F>
+void
+wrap_serialized_response(
+	const request_context_t & ctx,
+	F && functor)
+{
+	std::shared_ptr<const json_body_t> response_body;
+	try
+	{
+		response_body = functor();
+	}
+	catch(...)
+	{
+		std::string failure_body;
+		auto response_status = describe_current_exception(failure_body);
+		send_json_response(ctx, std::move(response_status), std::move(failure_body));
+		return;
+	}
+
+	send_json_response(ctx, restinio::status_ok(), std::move(response_body));
+}
+
+void
+write_string(
+	json_body_t::writer_t & writer,
+	const model::string_ref_t & str)
+{
+	writer.String(str.m_data, static_cast<rapidjson::SizeType>(str.m_size));
+}
+
+// Writes a pet in the same format as json_dto does
+// for model::pet_with_id_t.
+void
+write_pet(
+	json_body_t::writer_t & writer,
+	const model::pet_view_t & pet)
+{
+	writer.StartObject();
+	writer.Key("id");
+	writer.Int(pet.m_id);
+	writer.Key("name");
+	write_string(writer, pet.m_name);
+	writer.Key("type");
+	write_string(writer, pet.m_type);
+	writer.Key("owner");
+	write_string(writer, pet.m_owner);
+	writer.Key("picture");
+	write_string(writer, pet.m_picture);
+	writer.EndObject();
+}
+
+// Writes {"pets":[...]} in the same format as json_dto does
+// for model::all_pets_t.
+void
+write_pets(
+	json_body_t::writer_t & writer,
+	const model::arena_pets_t & pets)
+{
+	writer.StartObject();
+	writer.Key("pets");
+	writer.StartArray();
+	for(const auto & pet : pets)
+		write_pet(writer, pet);
+	writer.EndArray();
+	writer.EndObject();
+}
+
+// Appends a fragment of JSON to the buffer as is.
+void
+put_raw(rapidjson::StringBuffer & buffer, const char * fragment)
+{
+	for(; *fragment; ++fragment)
+		buffer.Put(*fragment);
+}
+
+// Helper function for wrapping the start of asynchronous processing
+// of a request.
+//
+// The response is made here only if the start fails. Otherwise it's
+// the responsibility of the completion handler of the started operation.
+template<typename F>
+void
+wrap_async_request_initiation(
+	const request_context_t & ctx,
+	F && initiator)
+{
+	std::string response_body;
+	try
+	{
+		initiator();
+		return;
+	}
+	catch(...)
+	{
+		auto response_status = describe_current_exception(response_body);
+		send_json_response(ctx, std::move(response_status), std::move(response_body));
+	}
+}
+
+// Helper for measuring the duration of an asynchronous DB operation:
+// from the start of the operation to the call of its completion handler.
+class async_db_timer_t
+{
+	const std::chrono::steady_clock::time_point m_started_at{
+			std::chrono::steady_clock::now()};
+
+public:
+	void
+	finish(const request_context_t & ctx) const
+	{
+		ctx.m_metrics.on_stage(ctx.m_route, stage_t::db,
+				std::chrono::steady_clock::now() - m_started_at);
+	}
+};
+
 // Helper function for wrapping actual business-logic code and intercept
 // errors related to JSON-processing, interactions with DB and so on.
 // All such errors are converted into request_processing_failure_t.
@@ -124,6 +321,15 @@ wrap_business_logic_action(F && functor)
 						fmt::format("json-related-error: {}", x.what())
 				});
 	}
+	catch(const write_rejected_t & x)
+	{
+		throw request_processing_failure_t(
+				restinio::status_service_unavailable(),
+				failure_description_t{
+						errors::server_overloaded,
+						fmt::format("server is overloaded: {}", x.what())
+				});
+	}
 	catch(const SQLite::Exception & x)
 	{
 		throw request_processing_failure_t(
@@ -139,6 +345,86 @@ wrap_business_logic_action(F && functor)
 	}
 }
 
+// The size of a chunk for sending the list of all pets.
+const std::size_t all_pets_chunk_size = 64u * 1024u;
+
+// How long the sending of a chunk can take. The worker thread and
+// the DB connection are held while waiting, so it's short.
+const std::chrono::seconds chunk_write_timeout{5};
+
+// Helper class for sending a response body by chunks.
+//
+// The write of the previous chunk should be completed before
+// the next chunk is sent. So no more than two chunks (the one being
+// written and the one being filled) are held in memory.
+class chunked_body_writer_t
+{
+	restinio::response_builder_t<restinio::chunked_output_t> m_response;
+
+	// The result of the write of the previous chunk.
+	std::future<bool> m_previous_write;
+
+	void
+	wait_previous_write()
+	{
+		if(!m_previous_write.valid())
+			return;
+
+		if(std::future_status::ready !=
+				m_previous_write.wait_for(chunk_write_timeout) ||
+				!m_previous_write.get())
+			throw std::runtime_error("unable to write a chunk of response");
+	}
+
+public:
+	chunked_body_writer_t(const request_context_t & ctx)
+		:	m_response{ctx.m_req->create_response<restinio::chunked_output_t>()}
+	{
+		// The status can't be changed after the first chunk is sent.
+		ctx.m_metrics.on_response(ctx.m_route, 200);
+
+		m_response
+			.append_header_date_field()
+			.append_header(restinio::http_field::content_type, "application/json");
+	}
+
+	void
+	write(restinio::writable_item_t chunk)
+	{
+		wait_previous_write();
+
+		auto write_result = std::make_shared<std::promise<bool>>();
+		m_previous_write = write_result->get_future();
+
+		m_response.append_chunk(std::move(chunk));
+		m_response.flush([write_result](const auto & ec) {
+				write_result->set_value(!ec);
+			});
+	}
+
+	void
+	finish()
+	{
+		wait_previous_write();
+		m_response.done();
+	}
+
+	// The response can't be completed normally because the status is
+	// already sent. The connection is closed to let the client know
+	// that the response is incomplete.
+	void
+	abort() noexcept
+	{
+		try
+		{
+			m_response.connection_close();
+			m_response.done();
+		}
+		catch(...)
+		{}
+	}
+};
+
 enum class create_new_mode_t
 {
 	single,
@@ -183,10 +469,309 @@ detect_create_new_mode(
 	return unexpected("unsupported value of Content-Type");
 }
 
+// The count of pets from a batch upload that are parsed and inserted
+// into the DB at once.
+const std::size_t batch_upload_chunk_size = 256u;
+
+// The max count of chunks of one request that wait for the insertion
+// at the same time. The request waits for the insertion of previous
+// chunks before submitting the next one.
+const std::size_t max_chunks_in_flight = 4u;
+
+// Helper for insertion of a big number of pets by chunks.
+//
+// Every chunk is a separate write operation. So the writer thread
+// isn't occupied by one request for the whole insertion: operations
+// of other requests are committed between chunks.
+//
+// NOTE: chunks are committed independently. Chunks committed before
+// a failed one stay in the DB.
+class chunked_insertion_t
+{
+	using chunk_result_t = write_result_t<model::bunch_of_pet_ids_t>;
+
+	// The state is shared with completion handlers.
+	struct state_t
+	{
+		std::mutex m_lock;
+		std::condition_variable m_chunk_completed;
+		std::size_t m_in_flight{0u};
+		// Results go in the order of chunks.
+		std::vector<nonstd::optional<chunk_result_t>> m_results;
+
+		void
+		complete(std::size_t index, chunk_result_t result)
+		{
+			std::lock_guard<std::mutex> lock{m_lock};
+			m_results[index] = std::move(result);
+			--m_in_flight;
+			m_chunk_completed.notify_all();
+		}
+	};
+
+	db_layer_t & m_db;
+	const std::shared_ptr<state_t> m_state{std::make_shared<state_t>()};
+
+public:
+	chunked_insertion_t(db_layer_t & db) : m_db{db} {}
+
+	// Waits if there are too many chunks in flight.
+	void
+	submit(std::vector<model::pet_without_id_t> pets)
+	{
+		std::size_t index;
+		{
+			std::unique_lock<std::mutex> lock{m_state->m_lock};
+			m_state->m_chunk_completed.wait(lock, [this] {
+					return m_state->m_in_flight < max_chunks_in_flight;
+				});
+			index = m_state->m_results.size();
+			m_state->m_results.emplace_back();
+			++m_state->m_in_flight;
+		}
+
+		try
+		{
+			model::bunch_of_pets_without_id_t chunk;
+			chunk.m_pets = std::move(pets);
+			m_db.async_create_bunch_of_pets(std::move(chunk),
+				[state = m_state, index](chunk_result_t result) {
+					state->complete(index, std::move(result));
+				});
+		}
+		catch(...)
+		{
+			m_state->complete(index, chunk_result_t{std::current_exception()});
+		}
+	}
+
+	// Submits pets by chunks of batch_upload_chunk_size.
+	void
+	submit_all(std::vector<model::pet_without_id_t> pets)
+	{
+		for(auto it = pets.begin(); it != pets.end();)
+		{
+			const auto count = std::min<std::size_t>(
+					batch_upload_chunk_size,
+					static_cast<std::size_t>(std::distance(it, pets.end())));
+			submit(std::vector<model::pet_without_id_t>(
+					std::make_move_iterator(it),
+					std::make_move_iterator(it + count)));
+			it += count;
+		}
+	}
+
+	// Waits for the insertion of all chunks.
+	// Results go in the order of submit() calls.
+	std::vector<chunk_result_t>
+	wait_all()
+	{
+		std::unique_lock<std::mutex> lock{m_state->m_lock};
+		m_state->m_chunk_completed.wait(lock, [this] {
+				return 0u == m_state->m_in_flight;
+			});
+
+		std::vector<chunk_result_t> results;
+		results.reserve(m_state->m_results.size());
+		for(auto & r : m_state->m_results)
+			results.push_back(std::move(*r));
+
+		return results;
+	}
+
+	// Waits for the insertion of all chunks and returns IDs of all pets.
+	// Throws the error of the first failed chunk.
+	model::bunch_of_pet_ids_t
+	wait_ids()
+	{
+		model::bunch_of_pet_ids_t ids;
+		for(auto & r : wait_all())
+		{
+			auto & chunk_ids = r.value().m_ids;
+			ids.m_ids.insert(ids.m_ids.end(), chunk_ids.begin(), chunk_ids.end());
+		}
+
+		return ids;
+	}
+};
+
+// Throws if the request doesn't have application/x-ndjson body.
+void
+ensure_ndjson_content_type(
+	const restinio::request_handle_t & req)
+{
+	const auto fail = [](const char * msg) {
+		throw request_processing_failure_t{
+				restinio::status_bad_request(),
+				failure_description_t{errors::invalid_request, msg}
+			};
+	};
+
+	const auto content_type_raw = req->header().opt_value_of(
+			restinio::http_field::content_type);
+	if(!content_type_raw)
+		fail("Content-Type HTTP-field is absent");
+
+	namespace hfp = restinio::http_field_parsers;
+	const auto content_type = hfp::content_type_value_t::try_parse(*content_type_raw);
+	if(!content_type)
+		fail("unable to parse Content-Type HTTP-field");
+
+	if("application" != content_type->media_type.type ||
+			"x-ndjson" != content_type->media_type.subtype)
+		fail("unsupported value of Content-Type");
+}
+
+// Shared state of the parallel parsing of a batch upload.
+//
+// Every part can be parsed either by a subtask on another worker
+// thread or by the thread that started the parsing. The one who
+// claims a part first parses it. So the parsing completes even if all
+// other worker threads are busy.
+class parallel_parsing_t
+{
+	struct part_t
+	{
+		json_fragment_t m_fragment;
+		std::atomic<bool> m_claimed{false};
+
+		std::vector<model::pet_without_id_t> m_pets;
+		std::exception_ptr m_error;
+	};
+
+	std::vector<part_t> m_parts;
+
+	std::mutex m_lock;
+	std::condition_variable m_part_parsed;
+	std::size_t m_parts_left;
+
+public:
+	parallel_parsing_t(const std::vector<json_fragment_t> & fragments)
+		:	m_parts(fragments.size())
+		,	m_parts_left{fragments.size()}
+	{
+		for(std::size_t i = 0u; i != fragments.size(); ++i)
+			m_parts[i].m_fragment = fragments[i];
+	}
+
+	std::size_t
+	parts_count() const noexcept
+	{
+		return m_parts.size();
+	}
+
+	// Parses a part if it isn't claimed yet.
+	void
+	try_parse(std::size_t index) noexcept
+	{
+		auto & part = m_parts[index];
+		if(part.m_claimed.exchange(true, std::memory_order_acq_rel))
+			return;
+
+		try
+		{
+			part.m_pets = parse_pets_fragment(part.m_fragment);
+		}
+		catch(...)
+		{
+			part.m_error = std::current_exception();
+		}
+
+		std::lock_guard<std::mutex> lock{m_lock};
+		if(0u == --m_parts_left)
+			m_part_parsed.notify_all();
+	}
+
+	// Waits for all parts and merges them in the order of the document.
+	// Throws the error of the first failed part.
+	model::bunch_of_pets_without_id_t
+	merge()
+	{
+		{
+			std::unique_lock<std::mutex> lock{m_lock};
+			m_part_parsed.wait(lock, [this] { return 0u == m_parts_left; });
+		}
+
+		std::size_t total = 0u;
+		for(const auto & part : m_parts)
+		{
+			if(part.m_error)
+				std::rethrow_exception(part.m_error);
+			total += part.m_pets.size();
+		}
+
+		model::bunch_of_pets_without_id_t result;
+		result.m_pets.reserve(total);
+		for(auto & part : m_parts)
+			std::move(part.m_pets.begin(), part.m_pets.end(),
+					std::back_inserter(result.m_pets));
+
+		return result;
+	}
+};
+
+// The count of pets in a page if limit isn't specified.
+const std::size_t default_page_limit = 100u;
+
+// The max allowed count of pets in a page.
+const std::size_t max_page_limit = 1000u;
+
+// Detects whether a page of the list of pets is requested.
+//
+// Returns empty optional if there are no paging parameters in the query.
+restinio::expected_t<
+	nonstd::optional<pets_page_request_t>,
+	request_processing_failure_t >
+detect_pets_page_request(
+	const restinio::request_handle_t & req)
+{
+	const auto unexpected = [](const char * msg) {
+		return restinio::make_unexpected(request_processing_failure_t{
+				restinio::status_bad_request(),
+				failure_description_t{errors::invalid_request, msg}
+			});
+	};
+
+	try
+	{
+		const auto qp = restinio::parse_query(req->header().query());
+		const auto limit = restinio::opt_value<std::uint32_t>(qp, "limit");
+		const auto after_id = restinio::opt_value<pet_id_t>(qp, "after_id");
+
+		if(!limit && !after_id)
+			return nonstd::optional<pets_page_request_t>{};
+
+		pets_page_request_t page{
+				after_id ? *after_id : pet_id_t{0},
+				limit ? std::size_t{*limit} : default_page_limit };
+		if(0u == page.m_limit || max_page_limit < page.m_limit)
+			return unexpected("limit should be in range [1, 1000]");
+
+		return nonstd::optional<pets_page_request_t>{page};
+	}
+	catch(const restinio::exception_t &)
+	{
+		return unexpected("unable to parse query parameters");
+	}
+}
+
 } /* namespace anonymous */
 
-request_processor_t::request_processor_t(db_layer_t & db)
+request_processor_t::request_processor_t(
+	db_layer_t & db,
+	metrics_registry_t & metrics,
+	const request_processor_params_t & params)
 	:	m_db{db}
+	,	m_metrics{metrics}
+	,	m_all_pets_mode{params.m_all_pets_mode}
+	,	m_streams_limit{params.m_max_concurrent_streams}
+	,	m_batches_limit{params.m_max_concurrent_batches}
+	,	m_pet_bodies{params.m_pet_bodies_cache}
+	,	m_batch_upload_parsing{params.m_batch_upload_parsing}
+	,	m_parallel_parsing_parts{params.m_parallel_parsing_parts}
+	,	m_min_size_for_parallel_parsing{params.m_min_size_for_parallel_parsing}
+	,	m_max_size_for_parallel_parsing{params.m_max_size_for_parallel_parsing}
+	,	m_subtask_executor{params.m_subtask_executor}
 {
 }
 
@@ -200,30 +785,66 @@ request_processor_t::on_create_new_pet(
 		switch(*mode)
 		{
 		case create_new_mode_t::single:
-			wrap_request_processing(req, [&] { return create_new_pet(req); });
+			create_new_pet(req);
 		break;
 
 		case create_new_mode_t::batch:
-			wrap_request_processing(req, [&] { return batch_create_new_pets(req); });
+			if(m_batches_limit.try_acquire())
+			{
+				concurrency_slot_t slot{m_batches_limit};
+				batch_create_new_pets(req);
+			}
+			else
+				on_overload(req, route_id_t::create_new_pet);
 		break;
 		}
 	}
 	else
-	{
-		const auto & error = mode.error();
-		req->create_response(error.response_status())
-			.append_header_date_field()
-			.append_header(restinio::http_field::content_type, "application/json")
-			.set_body(json_dto::to_json(error.failure_description()))
-			.done();
-	}
+		send_failure_response(
+				request_context_t{req, m_metrics, route_id_t::create_new_pet},
+				mode.error());
 }
 
 void
 request_processor_t::on_get_all_pets(
 	const restinio::request_handle_t & req)
 {
-	wrap_request_processing(req, [&] { return get_all_pets(); });
+	const request_context_t ctx{req, m_metrics, route_id_t::get_all_pets};
+
+	const auto page = detect_pets_page_request(req);
+	if(!page)
+		send_failure_response(ctx, page.error());
+	else if(*page)
+		wrap_serialized_response(ctx, [&] { return make_pets_page_body(**page); });
+	else if(all_pets_response_mode_t::chunked_stream == m_all_pets_mode)
+	{
+		// The whole list isn't read into memory above the limit,
+		// the client should retry later.
+		if(m_streams_limit.try_acquire())
+		{
+			concurrency_slot_t slot{m_streams_limit};
+			// NOTE: stream_all_pets() handles all exceptions itself.
+			stream_all_pets(req);
+		}
+		else
+			on_overload(req, route_id_t::get_all_pets);
+	}
+	else
+		wrap_serialized_response(ctx, [&] { return make_all_pets_body(); });
+}
+
+bool
+request_processor_t::try_get_specific_pet_from_cache(
+	const restinio::request_handle_t & req,
+	pet_id_t pet_id)
+{
+	auto body = m_pet_bodies.find(pet_id);
+	if(!body)
+		return false;
+
+	const request_context_t ctx{req, m_metrics, route_id_t::get_specific_pet};
+	send_json_response(ctx, restinio::status_ok(), std::move(*body));
+	return true;
 }
 
 void
@@ -231,7 +852,30 @@ request_processor_t::on_get_specific_pet(
 	const restinio::request_handle_t & req,
 	pet_id_t pet_id)
 {
-	wrap_request_processing(req, [&] { return get_specific_pet(pet_id); });
+	const request_context_t ctx{req, m_metrics, route_id_t::get_specific_pet};
+
+	// The ticket has to be taken before reading the pet.
+	const auto cache_ticket = m_pet_bodies.get_insert_ticket(pet_id);
+
+	std::shared_ptr<const std::string> new_body;
+	try
+	{
+		auto pet = get_specific_pet(pet_id);
+
+		stage_timer_t serialization_timer{
+				m_metrics, ctx.m_route, stage_t::serialization};
+		new_body = std::make_shared<const std::string>(json_dto::to_json(pet));
+	}
+	catch(...)
+	{
+		std::string response_body;
+		auto response_status = describe_current_exception(response_body);
+		send_json_response(ctx, std::move(response_status), std::move(response_body));
+		return;
+	}
+
+	m_pet_bodies.insert(cache_ticket, pet_id, new_body);
+	send_json_response(ctx, restinio::status_ok(), std::move(new_body));
 }
 
 void
@@ -239,7 +883,7 @@ request_processor_t::on_patch_specific_pet(
 	const restinio::request_handle_t & req,
 	pet_id_t pet_id)
 {
-	wrap_request_processing(req, [&] { return patch_specific_pet(req, pet_id); });
+	patch_specific_pet(req, pet_id);
 }
 
 void
@@ -247,13 +891,28 @@ request_processor_t::on_delete_specific_pet(
 	const restinio::request_handle_t & req,
 	pet_id_t pet_id)
 {
-	wrap_request_processing(req, [&] { return delete_specific_pet(pet_id); });
+	delete_specific_pet(req, pet_id);
+}
+
+void
+request_processor_t::on_overload(
+	const restinio::request_handle_t & req,
+	route_id_t route)
+{
+	send_json_response(request_context_t{req, m_metrics, route},
+			restinio::status_service_unavailable(),
+			json_dto::to_json(
+				failure_description_t{
+						errors::server_overloaded,
+						"server is overloaded, try again later"}));
 }
 
 void
 request_processor_t::on_make_batch_upload_form(
 	const restinio::request_handle_t & req)
 {
+	m_metrics.on_response(route_id_t::batch_upload_form, 200);
+
 	req->create_response()
 		.append_header_date_field()
 		.append_header(restinio::http_field::content_type, "text/html; charset=utf-8")
@@ -278,25 +937,60 @@ R"---(
 		.done();
 }
 
-model::pet_identity_t
+void
+request_processor_t::on_bulk_import(
+	const restinio::request_handle_t & req)
+{
+	const request_context_t ctx{req, m_metrics, route_id_t::bulk_import};
+
+	if(!m_batches_limit.try_acquire())
+	{
+		on_overload(req, route_id_t::bulk_import);
+		return;
+	}
+	concurrency_slot_t slot{m_batches_limit};
+
+	wrap_request_processing(ctx, [&] {
+			ensure_ndjson_content_type(req);
+			return wrap_business_logic_action([&] {
+					return bulk_import(req->body());
+				});
+		});
+}
+
+void
 request_processor_t::create_new_pet(
 	const restinio::request_handle_t & req)
 {
-	return wrap_business_logic_action([&] {
-			return model::pet_identity_t{
-				m_db.create_new_pet(
-						json_dto::from_json<model::pet_without_id_t>(req->body()))
-			};
+	const request_context_t ctx{req, m_metrics, route_id_t::create_new_pet};
+
+	wrap_async_request_initiation(ctx, [&] {
+			auto pet = wrap_business_logic_action([&] {
+					return json_dto::from_json<model::pet_without_id_t>(req->body());
+				});
+
+			m_db.async_create_new_pet(std::move(pet),
+				[ctx, db_timer = async_db_timer_t{}](write_result_t<pet_id_t> result) {
+					db_timer.finish(ctx);
+					wrap_request_processing(ctx, [&] {
+						return wrap_business_logic_action([&] {
+								return model::pet_identity_t{ result.value() };
+							});
+					});
+				});
 		});
 }
 
-model::bunch_of_pet_ids_t
+void
 request_processor_t::batch_create_new_pets(
 	const restinio::request_handle_t & req)
 {
 	using namespace restinio::file_upload;
 
-	return wrap_business_logic_action([&]() {
+	const request_context_t ctx{req, m_metrics, route_id_t::create_new_pet};
+
+	wrap_request_processing(ctx, [&] {
+		return wrap_business_logic_action([&] {
 			// Content of file with new pets should be found in
 			// the request's body.
 			//
@@ -306,7 +1000,7 @@ request_processor_t::batch_create_new_pets(
 			//
 			restinio::string_view_t uploaded_content;
 			const auto result = enumerate_parts_with_files(*req,
-				[this, &uploaded_content](part_description_t part) {
+				[&uploaded_content](part_description_t part) {
 					if("file" == part.name)
 					{
 						uploaded_content = part.body;
@@ -325,29 +1019,306 @@ request_processor_t::batch_create_new_pets(
 								"no file with new pets found"
 						});
 
-			// The content of uploaded file should be parsed.
-			const auto pets = json_dto::from_json<model::bunch_of_pets_without_id_t>(
-					json_dto::make_string_ref(
-							uploaded_content.data(), uploaded_content.size()));
+			// The content is parsed on the current worker thread, only
+			// the insertion of chunks is performed by the writer thread.
+			chunked_insertion_t insertion{m_db};
+			if(batch_upload_parsing_t::parallel == m_batch_upload_parsing &&
+					m_subtask_executor &&
+					m_min_size_for_parallel_parsing <= uploaded_content.size() &&
+					uploaded_content.size() <= m_max_size_for_parallel_parsing)
+			{
+				insertion.submit_all(
+						parse_bunch_of_pets_in_parallel(uploaded_content).m_pets);
+			}
+			else
+			{
+				// The whole content is checked before the insertion of
+				// the first chunk, so invalid content doesn't create any pets.
+				// Pets aren't built by the check, so the content is
+				// actually parsed only once.
+				check_bunch_of_pets(
+						uploaded_content.data(),
+						uploaded_content.size());
+
+				// Pets are inserted as soon as they are parsed, so the whole
+				// list of pets isn't built in memory.
+				parse_bunch_of_pets(
+						uploaded_content.data(),
+						uploaded_content.size(),
+						batch_upload_chunk_size,
+						[&insertion](std::vector<model::pet_without_id_t> & pets) {
+							insertion.submit(std::move(pets));
+						});
+			}
+
+			stage_timer_t db_timer{
+					m_metrics, route_id_t::create_new_pet, stage_t::db};
+			return insertion.wait_ids();
+		});
+	});
+}
+
+model::bunch_of_pets_without_id_t
+request_processor_t::parse_bunch_of_pets_in_parallel(
+	restinio::string_view_t content)
+{
+	auto parsing = std::make_shared<parallel_parsing_t>(
+			split_pets_array(
+					content.data(), content.size(), m_parallel_parsing_parts));
+
+	// The first part is left for the current thread.
+	try
+	{
+		for(std::size_t i = 1u; i < parsing->parts_count(); ++i)
+			m_subtask_executor([parsing, i] { parsing->try_parse(i); });
+	}
+	catch(...)
+	{
+		// Parts that can't be passed to other threads will be parsed here.
+	}
+
+	// Parts that aren't taken by other threads yet are parsed here.
+	// NOTE: the content can't be released until all parts are parsed,
+	// so merge() waits for parts taken by other threads.
+	for(std::size_t i = 0u; i != parsing->parts_count(); ++i)
+		parsing->try_parse(i);
+
+	return parsing->merge();
+}
+
+model::bulk_import_result_t
+request_processor_t::bulk_import(restinio::string_view_t body)
+{
+	using chunk_t = std::vector<model::pet_without_id_t>;
+
+	model::bulk_import_result_t result;
+
+	// Lines are parsed on the current thread and every chunk is inserted
+	// by a separate write operation. So parsing of the next chunk overlaps
+	// with the insertion of previous ones.
+	chunked_insertion_t insertion{m_db};
+
+	// Numbers of lines of every submitted chunk. They are necessary
+	// for reporting errors of a chunk that can't be inserted.
+	std::vector<std::vector<std::uint64_t>> chunks_lines;
+
+	chunk_t chunk;
+	std::vector<std::uint64_t> lines;
+	const auto submit_chunk = [&] {
+			insertion.submit(std::move(chunk));
+			chunks_lines.push_back(std::move(lines));
+
+			chunk = chunk_t{};
+			chunk.reserve(batch_upload_chunk_size);
+			lines = std::vector<std::uint64_t>{};
+		};
+
+	chunk.reserve(batch_upload_chunk_size);
 
-			return m_db.create_bunch_of_pets(pets);
+	std::uint64_t line_number = 0u;
+	std::size_t pos = 0u;
+	while(pos < body.size())
+	{
+		++line_number;
+
+		auto eol = body.find('\n', pos);
+		if(restinio::string_view_t::npos == eol)
+			eol = body.size();
+
+		auto line = body.substr(pos, eol - pos);
+		pos = eol + 1u;
+
+		if(!line.empty() && '\r' == line.back())
+			line.remove_suffix(1u);
+		if(line.empty())
+			continue;
+
+		try
+		{
+			chunk.push_back(json_dto::from_json<model::pet_without_id_t>(
+					json_dto::make_string_ref(line.data(), line.size())));
+			lines.push_back(line_number);
+		}
+		catch(const json_dto::ex_t & x)
+		{
+			result.m_errors.push_back(
+					model::bulk_import_error_t{line_number, x.what()});
+			continue;
+		}
+
+		if(batch_upload_chunk_size == chunk.size())
+			submit_chunk();
+	}
+
+	if(!chunk.empty())
+		submit_chunk();
+
+	stage_timer_t db_timer{m_metrics, route_id_t::bulk_import, stage_t::db};
+	auto chunks_results = insertion.wait_all();
+	bool chunk_failed = false;
+	for(std::size_t i = 0u; i != chunks_results.size(); ++i)
+	{
+		try
+		{
+			const auto & ids = chunks_results[i].value().m_ids;
+			result.m_ids.insert(result.m_ids.end(), ids.begin(), ids.end());
+		}
+		catch(const std::exception & x)
+		{
+			// All lines of the failed chunk are reported.
+			chunk_failed = true;
+			for(const auto line : chunks_lines[i])
+				result.m_errors.push_back(
+						model::bulk_import_error_t{line, x.what()});
+		}
+	}
+
+	if(chunk_failed)
+		std::sort(result.m_errors.begin(), result.m_errors.end(),
+				[](const auto & a, const auto & b) { return a.m_line < b.m_line; });
+
+	return result;
+}
+
+std::shared_ptr<const json_body_t>
+request_processor_t::make_all_pets_body()
+{
+	return wrap_business_logic_action([&] {
+			auto & arena = monotonic_arena_t::for_current_thread();
+			// All pets are released before the reset of the arena.
+			arena_reset_guard_t arena_reset{arena};
+
+			const auto pets = [&] {
+					stage_timer_t db_timer{
+							m_metrics, route_id_t::get_all_pets, stage_t::db};
+					return m_db.get_all_pets(arena);
+				}();
+
+			stage_timer_t serialization_timer{
+					m_metrics, route_id_t::get_all_pets, stage_t::serialization};
+			return pooled_json_serializer_t::for_current_thread().write(
+				[&pets](json_body_t::writer_t & writer) {
+					write_pets(writer, pets);
+				});
 		});
 }
 
-model::all_pets_t
-request_processor_t::get_all_pets()
+std::shared_ptr<const json_body_t>
+request_processor_t::make_pets_page_body(const pets_page_request_t & page)
 {
 	return wrap_business_logic_action([&] {
-			return m_db.get_all_pets();
+			// Reading and serialization are interleaved here,
+			// so both of them are counted as the DB stage.
+			stage_timer_t db_timer{m_metrics, route_id_t::get_all_pets, stage_t::db};
+
+			return pooled_json_serializer_t::for_current_thread().write(
+				[&](json_body_t::writer_t & writer) {
+					writer.StartObject();
+					writer.Key("pets");
+					writer.StartArray();
+					const auto next = m_db.for_each_pet_in_page(
+							page.m_after_id, page.m_limit,
+							[&writer](const model::pet_view_t & pet) {
+								write_pet(writer, pet);
+							});
+					writer.EndArray();
+
+					// The value for after_id to get the next page.
+					// It's null if there are no more pets.
+					writer.Key("next");
+					if(next)
+						writer.Int(*next);
+					else
+						writer.Null();
+					writer.EndObject();
+				});
 		});
 }
 
+void
+request_processor_t::stream_all_pets(
+	const restinio::request_handle_t & req)
+{
+	const request_context_t ctx{req, m_metrics, route_id_t::get_all_pets};
+
+	// The writer is created only when the first full chunk is ready.
+	// If the list is small it will be sent as an ordinary response.
+	nonstd::optional<chunked_body_writer_t> writer;
+
+	// Pets are serialized right from the rows of the DB into
+	// the buffer of the current chunk.
+	auto & serializer = pooled_json_serializer_t::for_current_thread();
+	std::shared_ptr<json_body_t> chunk;
+	rapidjson::StringBuffer * buffer = nullptr;
+	const auto start_chunk = [&] {
+			chunk = serializer.acquire_body();
+			buffer = &chunk->start();
+		};
+
+	try
+	{
+		start_chunk();
+		put_raw(*buffer, R"({"pets":[)");
+
+		bool first_pet = true;
+		json_body_t::writer_t pet_writer{*buffer};
+		wrap_business_logic_action([&] {
+				// Reading, serialization and sending are interleaved here,
+				// so all of them are counted as the DB stage.
+				stage_timer_t db_timer{m_metrics, ctx.m_route, stage_t::db};
+				m_db.for_each_pet([&](const model::pet_view_t & pet) {
+					if(!first_pet)
+						buffer->Put(',');
+					first_pet = false;
+
+					// Every pet is written as a separate JSON value.
+					pet_writer.Reset(*buffer);
+					write_pet(pet_writer, pet);
+
+					if(all_pets_chunk_size <= buffer->GetSize())
+					{
+						chunk->finish();
+						if(!writer)
+							writer.emplace(ctx);
+						writer->write(std::move(chunk));
+						start_chunk();
+					}
+				});
+			});
+
+		put_raw(*buffer, "]}");
+		chunk->finish();
+		if(writer)
+		{
+			writer->write(std::move(chunk));
+			writer->finish();
+		}
+		else
+			send_json_response(ctx, restinio::status_ok(), std::move(chunk));
+	}
+	catch(...)
+	{
+		if(writer)
+			writer->abort();
+		else
+		{
+			std::string response_body;
+			auto response_status = describe_current_exception(response_body);
+			send_json_response(ctx, std::move(response_status), std::move(response_body));
+		}
+	}
+}
+
 model::pet_with_id_t
 request_processor_t::get_specific_pet(
 	pet_id_t pet_id)
 {
 	return wrap_business_logic_action([&] {
-			auto pet = m_db.get_pet(pet_id);
+			auto pet = [&] {
+					stage_timer_t db_timer{
+							m_metrics, route_id_t::get_specific_pet, stage_t::db};
+					return m_db.get_pet(pet_id);
+				}();
 			if(!pet)
 				throw request_processing_failure_t(
 						restinio::status_not_found(),
@@ -359,40 +1330,67 @@ request_processor_t::get_specific_pet(
 		});
 }
 
-model::pet_identity_t
+void
 request_processor_t::patch_specific_pet(
 	const restinio::request_handle_t & req,
 	pet_id_t pet_id)
 {
-	return wrap_business_logic_action([&] {
-			const auto update_result = m_db.update_pet(
-					pet_id,
-					json_dto::from_json<model::pet_without_id_t>(req->body()));
-			if(db_layer_t::update_result_t::updated != update_result)
-				throw request_processing_failure_t(
-						restinio::status_not_found(),
-						failure_description_t{
-								errors::invalid_pet_id,
-								fmt::format("pet with this ID not found, ID={}", pet_id)
-						});
-			return model::pet_identity_t{pet_id};
+	const request_context_t ctx{req, m_metrics, route_id_t::patch_specific_pet};
+
+	wrap_async_request_initiation(ctx, [&] {
+			auto pet = wrap_business_logic_action([&] {
+					return json_dto::from_json<model::pet_without_id_t>(req->body());
+				});
+
+			m_db.async_update_pet(pet_id, std::move(pet),
+				[this, ctx, pet_id, db_timer = async_db_timer_t{}](
+					write_result_t<db_layer_t::update_result_t> result)
+				{
+					db_timer.finish(ctx);
+					m_pet_bodies.erase(pet_id);
+					wrap_request_processing(ctx, [&] {
+						return wrap_business_logic_action([&] {
+								if(db_layer_t::update_result_t::updated != result.value())
+									throw request_processing_failure_t(
+											restinio::status_not_found(),
+											failure_description_t{
+													errors::invalid_pet_id,
+													fmt::format("pet with this ID not found, ID={}", pet_id)
+											});
+								return model::pet_identity_t{pet_id};
+							});
+					});
+				});
 		});
 }
 
-model::pet_identity_t
+void
 request_processor_t::delete_specific_pet(
+	const restinio::request_handle_t & req,
 	pet_id_t pet_id)
 {
-	return wrap_business_logic_action([&] {
-			const auto delete_result = m_db.delete_pet(pet_id);
-			if(db_layer_t::delete_result_t::deleted != delete_result)
-				throw request_processing_failure_t(
-						restinio::status_not_found(),
-						failure_description_t{
-								errors::invalid_pet_id,
-								fmt::format("pet with this ID not found, ID={}", pet_id)
-						});
-			return model::pet_identity_t{pet_id};
+	const request_context_t ctx{req, m_metrics, route_id_t::delete_specific_pet};
+
+	wrap_async_request_initiation(ctx, [&] {
+			m_db.async_delete_pet(pet_id,
+				[this, ctx, pet_id, db_timer = async_db_timer_t{}](
+					write_result_t<db_layer_t::delete_result_t> result)
+				{
+					db_timer.finish(ctx);
+					m_pet_bodies.erase(pet_id);
+					wrap_request_processing(ctx, [&] {
+						return wrap_business_logic_action([&] {
+								if(db_layer_t::delete_result_t::deleted != result.value())
+									throw request_processing_failure_t(
+											restinio::status_not_found(),
+											failure_description_t{
+													errors::invalid_pet_id,
+													fmt::format("pet with this ID not found, ID={}", pet_id)
+											});
+								return model::pet_identity_t{pet_id};
+							});
+					});
+				});
 		});
 }
 
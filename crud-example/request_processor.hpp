@@ -6,14 +6,97 @@
 
 #include "pet_data_types.hpp"
 #include "db_layer.hpp"
+#include "lru_cache.hpp"
+#include "metrics.hpp"
+#include "multithreading.hpp"
+
+#include <chrono>
+#include <functional>
+#include <memory>
 
 namespace crud_example
 {
 
+class json_body_t;
+
+// How the response with the list of all pets is made.
+enum class all_pets_response_mode_t
+{
+	// The whole list is serialized into a single response body.
+	single_body,
+	// The list is sent by chunks while pets are read from the DB.
+	chunked_stream
+};
+
+// How a file from the batch upload form is parsed.
+enum class batch_upload_parsing_t
+{
+	// The file is parsed on the writer thread while pets are inserted.
+	streaming,
+	// Parts of a big file are parsed on several worker threads.
+	parallel
+};
+
+// Type of function that runs a part of request processing
+// on another worker thread.
+using subtask_executor_t = std::function<void(std::function<void()>)>;
+
+// Parameters of a request for a page of the list of pets.
+struct pets_page_request_t
+{
+	pet_id_t m_after_id;
+	std::size_t m_limit;
+};
+
+// Parameters for request_processor_t.
+struct request_processor_params_t
+{
+	all_pets_response_mode_t m_all_pets_mode{
+			all_pets_response_mode_t::single_body};
+
+	// Parameters of the cache of ready to send bodies of
+	// responses for GET /all/v1/pets/:id.
+	cache_params_t m_pet_bodies_cache;
+
+	batch_upload_parsing_t m_batch_upload_parsing{
+			batch_upload_parsing_t::streaming};
+
+	// The max count of parts for batch_upload_parsing_t::parallel.
+	std::size_t m_parallel_parsing_parts{4u};
+
+	// Smaller files are parsed by the streaming parser anyway.
+	std::size_t m_min_size_for_parallel_parsing{1024u * 1024u};
+
+	// Bigger files are parsed by the streaming parser too: the parallel
+	// parser builds all pets of the file in memory before the insertion.
+	std::size_t m_max_size_for_parallel_parsing{16u * 1024u * 1024u};
+
+	// Should be set for batch_upload_parsing_t::parallel.
+	subtask_executor_t m_subtask_executor;
+
+	// The max count of lists of pets that are sent by chunks at
+	// the same time. Every such response holds a worker thread and
+	// a read-only DB connection until a slow client reads it, so
+	// the limit should be less than the count of reading threads.
+	// Above the limit requests for the list get 503.
+	std::size_t m_max_concurrent_streams{1u};
+
+	// The max count of batch uploads and bulk imports that are
+	// processed at the same time. Every such request holds a writing
+	// thread until all its chunks are inserted, so the limit should be
+	// less than the count of writing threads. Otherwise modifications
+	// of single pets wait while all writing threads wait for chunks.
+	// Above the limit requests get 503.
+	std::size_t m_max_concurrent_batches{1u};
+};
+
 class request_processor_t
 {
 public:
-	request_processor_t(db_layer_t & db);
+	request_processor_t(
+		db_layer_t & db,
+		metrics_registry_t & metrics,
+		const request_processor_params_t & params);
 
 	void
 	on_create_new_pet(
@@ -23,6 +106,20 @@ public:
 	on_get_all_pets(
 		const restinio::request_handle_t & req);
 
+	// Sends the response if the body of the pet is in the cache.
+	// Returns false if it isn't.
+	//
+	// It's cheap and doesn't block, so it can be called right on
+	// the IO thread.
+	bool
+	try_get_specific_pet_from_cache(
+		const restinio::request_handle_t & req,
+		pet_id_t pet_id);
+
+	// Reads the pet from the DB and puts its body into the cache.
+	//
+	// NOTE: the cache isn't checked here, it should be done by
+	// try_get_specific_pet_from_cache() before.
 	void
 	on_get_specific_pet(
 		const restinio::request_handle_t & req,
@@ -42,28 +139,88 @@ public:
 	on_make_batch_upload_form(
 		const restinio::request_handle_t & req);
 
+	// Creates pets from NDJSON body: one pet per line.
+	void
+	on_bulk_import(
+		const restinio::request_handle_t & req);
+
+	// Responds with 503 to a request that can't be processed
+	// because the server is overloaded.
+	void
+	on_overload(
+		const restinio::request_handle_t & req,
+		route_id_t route);
+
+	cache_stats_t
+	pet_bodies_cache_stats() const
+	{
+		return m_pet_bodies.stats();
+	}
+
 private:
 	db_layer_t & m_db;
 
-	model::pet_identity_t
+	metrics_registry_t & m_metrics;
+
+	const all_pets_response_mode_t m_all_pets_mode;
+
+	concurrency_limit_t m_streams_limit;
+	concurrency_limit_t m_batches_limit;
+
+	// Serialized pets are stored in immutable shared buffers.
+	// A buffer is passed to RESTinio as is, without copying.
+	//
+	// An item is removed from the cache when the pet is updated or
+	// deleted.
+	using pet_bodies_cache_t = sharded_lru_cache_t<
+			pet_id_t, std::shared_ptr<const std::string> >;
+
+	pet_bodies_cache_t m_pet_bodies;
+
+	const batch_upload_parsing_t m_batch_upload_parsing;
+	const std::size_t m_parallel_parsing_parts;
+	const std::size_t m_min_size_for_parallel_parsing;
+	const std::size_t m_max_size_for_parallel_parsing;
+	const subtask_executor_t m_subtask_executor;
+
+	// NOTE: write operations are performed asynchronously, the
+	// response is made by the completion handler of the operation.
+	void
 	create_new_pet(const restinio::request_handle_t & req);
 
-	model::bunch_of_pet_ids_t
+	void
 	batch_create_new_pets(const restinio::request_handle_t & req);
 
-	model::all_pets_t
-	get_all_pets();
+	model::bunch_of_pets_without_id_t
+	parse_bunch_of_pets_in_parallel(restinio::string_view_t content);
+
+	model::bulk_import_result_t
+	bulk_import(restinio::string_view_t body);
+
+	// The list of all pets is read into the arena of the current thread
+	// and is serialized directly into the body of the response.
+	std::shared_ptr<const json_body_t>
+	make_all_pets_body();
+
+	void
+	stream_all_pets(const restinio::request_handle_t & req);
+
+	// Pets are serialized right from the rows of the DB.
+	std::shared_ptr<const json_body_t>
+	make_pets_page_body(const pets_page_request_t & page);
 
 	model::pet_with_id_t
 	get_specific_pet(pet_id_t pet_id);
 
-	model::pet_identity_t
+	void
 	patch_specific_pet(
 		const restinio::request_handle_t & req,
 		pet_id_t pet_id);
 
-	model::pet_identity_t
-	delete_specific_pet(pet_id_t pet_id);
+	void
+	delete_specific_pet(
+		const restinio::request_handle_t & req,
+		pet_id_t pet_id);
 };
 
 } /* namespace crud_example */